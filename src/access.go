@@ -0,0 +1,160 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"fmt"
+	"os"
+	"regexp"
+	"sort"
+	"strconv"
+	"strings"
+)
+
+// hotShare is the share of all reads that the parameters suggested as hot
+// account for together.
+const hotShare = 0.8
+
+type AccessCount struct {
+	Name  string
+	Count uint64
+}
+
+// readAccessReport reads the "name count" lines written by the generated
+// config_access_report().
+func readAccessReport(file string) ([]AccessCount, error) {
+	var counts []AccessCount
+
+	f, err := os.Open(file)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	scanner := bufio.NewScanner(f)
+	for line := 1; scanner.Scan(); line++ {
+		fields := strings.Fields(scanner.Text())
+		if len(fields) == 0 {
+			continue
+		}
+		if len(fields) != 2 {
+			return nil, fmt.Errorf("%s:%d: expected a name and a count", file, line)
+		}
+
+		count, err := strconv.ParseUint(fields[1], 10, 64)
+		if err != nil {
+			return nil, fmt.Errorf("%s:%d: %v", file, line, err)
+		}
+		counts = append(counts, AccessCount{Name: fields[0], Count: count})
+	}
+
+	return counts, scanner.Err()
+}
+
+// suggestAnnotations marks the most read parameters, which together make
+// up hotShare of all reads, as hot and the ones never read as lazy.
+// Parameters missing from the report are left out.
+func suggestAnnotations(cfg *Config, counts []AccessCount) map[string]string {
+	known := make(map[string]bool)
+	for _, p := range cfg.Parameters {
+		known[p.Name] = true
+	}
+
+	var total uint64
+	var sorted []AccessCount
+	for _, c := range counts {
+		if !known[c.Name] {
+			fmt.Fprintf(os.Stderr, "%s is not in the schema, ignored\n", c.Name)
+			continue
+		}
+		total += c.Count
+		sorted = append(sorted, c)
+	}
+
+	sort.SliceStable(sorted, func(i, j int) bool {
+		return sorted[i].Count > sorted[j].Count
+	})
+
+	res := make(map[string]string)
+	var sum uint64
+	for _, c := range sorted {
+		switch {
+		case c.Count == 0:
+			res[c.Name] = "lazy"
+		case float64(sum) < hotShare*float64(total):
+			res[c.Name] = "hot"
+		default:
+			res[c.Name] = ""
+		}
+		sum += c.Count
+	}
+
+	return res
+}
+
+var paramLine = regexp.MustCompile(`^(\s*)- name:\s*(\S+)\s*$`)
+var annotationLine = regexp.MustCompile(`^\s*(hot|lazy):`)
+
+// applyAnnotations rewrites the hot and lazy keys of the annotated
+// parameters in the schema. It edits the text rather than re-encoding the
+// yaml so that ordering, comments and formatting are kept.
+func applyAnnotations(schema []byte, annotations map[string]string) []byte {
+	var out bytes.Buffer
+	indent := -1
+	current := ""
+
+	for _, line := range strings.SplitAfter(string(schema), "\n") {
+		if m := paramLine.FindStringSubmatch(line); m != nil && (indent < 0 || len(m[1]) == indent) {
+			indent = len(m[1])
+			current = m[2]
+			out.WriteString(line)
+			if a := annotations[current]; a != "" {
+				fmt.Fprintf(&out, "%s  %s: true\n", m[1], a)
+			}
+			continue
+		}
+
+		if _, ok := annotations[current]; ok && annotationLine.MatchString(line) &&
+			len(line)-len(strings.TrimLeft(line, " ")) == indent+2 {
+			continue
+		}
+
+		out.WriteString(line)
+	}
+
+	return out.Bytes()
+}
+
+// validateAnnotations checks that no parameter is both hot and lazy.
+func validateAnnotations(list []Parameter) error {
+	for _, p := range list {
+		if p.Hot && p.Lazy {
+			return fmt.Errorf("%s can not be both hot and lazy", p.Name)
+		}
+	}
+
+	return nil
+}
+
+// layoutRank orders struct members: hot ones first, lazy ones last. A
+// nested struct ranks as its hottest member.
+func layoutRank(def *Tree) int {
+	if def.Def != nil {
+		switch {
+		case def.Def.Hot:
+			return 0
+		case def.Def.Lazy:
+			return 2
+		}
+		return 1
+	}
+
+	rank := 2
+	for _, v := range def.Leafs {
+		if r := layoutRank(v); r < rank {
+			rank = r
+		}
+	}
+
+	return rank
+}
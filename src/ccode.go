@@ -3,7 +3,10 @@ package main
 import (
 	"bytes"
 	"embed"
+	"encoding/json"
 	"fmt"
+	"sort"
+	"strconv"
 	"strings"
 	"text/template"
 )
@@ -40,6 +43,7 @@ type JsonParameter struct {
 	Name     string
 	FullName string
 	Type     string
+	Reader   string
 }
 
 type JsonObject struct {
@@ -61,18 +65,96 @@ type Enum struct {
 	Options  []EnumOption
 }
 
+type MsgpackKey struct {
+	Name     string
+	Len      int
+	FullName string
+	Reader   string
+	Func     string
+}
+
+type MsgpackObject struct {
+	Func string
+	Keys []MsgpackKey
+}
+
+type MapField struct {
+	Name  string
+	Json  string
+	Type  string
+	CType string
+	Desc  string
+}
+
+type Map struct {
+	Name        string
+	FlatRef     string
+	Module      string
+	Fields      []MapField
+	SetFields   []string
+	Validators  []string
+	JsonParents []string
+	JsonKey     string
+	Sample      string
+}
+
+type ClearRef struct {
+	Ref  string
+	Func string
+}
+
+type Accessor struct {
+	Name    string
+	FlatRef string
+	Enum    string
+	Type    string
+	Ref     string
+}
+
+type CheckAndSet struct {
+	Name string
+	Json string
+	Call string
+}
+
 type Output struct {
 	Definitions     []Definition
 	SetEnv          []SetEnv
 	SetOpt          []SetOpt
 	SetDefault      []SetDefault
-	CheckAndSet     []string
+	CheckAndSet     []CheckAndSet
 	ValidateOptions []string
-	Clear           []string
+	Clear           []ClearRef
 	JsonObjects     []JsonObject
 	JsonParameters  []string
+	MsgpackObjects  []MsgpackObject
+	MsgpackRoot     string
 	OutputFormat    string
 	Enums           []Enum
+	Maps            []Map
+	Patterns        []Parameter
+	Files           []Parameter
+	AccessCounters  bool
+	Accessors       []Accessor
+	Prefix          string
+	Header          string
+	Module          string
+	Modules         []Module
+	Readers         map[string]bool
+	Setters         map[string]bool
+}
+
+// GenOptions selects what is generated for one schema. Module is empty
+// when the schema is generated on its own into config.c and config.h.
+type GenOptions struct {
+	Counters bool
+	Module   string
+}
+
+type Module struct {
+	Name   string
+	Prefix string
+	Header string
 }
 
 //go:embed templates/*
@@ -82,33 +164,78 @@ func structRef(p Parameter) string {
 	return "cfg->" + p.Name
 }
 
-func getDefinition(def *Tree, list []Definition) []Definition {
-	var out Definition
+// readerName is the suffix of the json_*_candidate and msgpack_*_candidate
+// functions used to read p.
+func readerName(p *Parameter) string {
+	if p.Type == "map" {
+		return "map_" + p.FlatRef
+	}
+	return p.Type
+}
 
-	out.Name = def.Name
+func cType(p *Parameter) string {
+	var ctype string
+	switch p.Type {
+	case "string":
+		ctype = "gchar *"
+	case "int":
+		ctype = "gint64 "
+	case "size":
+		ctype = "gint64 "
+	case "double":
+		ctype = "gdouble "
+	case "boolean":
+		ctype = "gboolean "
+	case "enum":
+		enum_name := "config_" + p.FlatRef
+		ctype = "enum " + enum_name + " "
+	case "map":
+		ctype = "struct config_" + p.FlatRef + " "
+	case "regex", "glob":
+		ctype = "GRegex *"
+	case "file":
+		ctype = "struct config_file "
+	}
+	return ctype
+}
 
+// sortedLeafs returns the children of def ordered by name, so that the
+// generated code does not depend on map iteration order.
+func sortedLeafs(def *Tree) []*Tree {
+	leafs := make([]*Tree, 0, len(def.Leafs))
 	for _, v := range def.Leafs {
+		leafs = append(leafs, v)
+	}
+	sort.Slice(leafs, func(i, j int) bool {
+		return leafs[i].Name < leafs[j].Name
+	})
+
+	return leafs
+}
+
+// getDefinition lists the struct of def, named name, after the structs it
+// contains. With scoped set the nested structs are named after their full
+// path so that the headers of several modules can be included together.
+func getDefinition(def *Tree, name string, scoped bool, list []Definition) []Definition {
+	var out Definition
+
+	out.Name = name
+
+	leafs := sortedLeafs(def)
+	sort.SliceStable(leafs, func(i, j int) bool {
+		return layoutRank(leafs[i]) < layoutRank(leafs[j])
+	})
+
+	for _, v := range leafs {
 		if v.Def != nil {
-			var ctype string
-			switch v.Def.Type {
-			case "string":
-				ctype = "gchar *"
-			case "int":
-				ctype = "gint64 "
-			case "size":
-				ctype = "gint64 "
-			case "double":
-				ctype = "gdouble "
-			case "boolean":
-				ctype = "gboolean "
-			case "enum":
-				enum_name := "config_" + v.Def.FlatRef
-				ctype = "enum " + enum_name + " "
-			}
-			out.Variables = append(out.Variables, Definition{Name: v.Name, Type: ctype, Description: v.Def.Desc})
+			out.Variables = append(out.Variables, Definition{Name: v.Name, Type: cType(v.Def), Description: v.Def.Desc})
 		} else {
-			out.Variables = append(out.Variables, Definition{Name: v.Name, Type: fmt.Sprintf("struct %s ", v.Name)})
-			list = getDefinition(v, list)
+			child := v.Name
+			if scoped {
+				child = name + "_" + v.Name
+			}
+			out.Variables = append(out.Variables, Definition{Name: v.Name, Type: fmt.Sprintf("struct %s ", child)})
+			list = getDefinition(v, child, scoped, list)
 		}
 	}
 	list = append(list, out)
@@ -119,8 +246,6 @@ func getDefinition(def *Tree, list []Definition) []Definition {
 func getJson(def *Tree, list *[]JsonObject, parent string) {
 	var out JsonObject
 
-	fmt.Println("Name of json node: " + def.Name)
-	fmt.Println("Count of leaves: ", len(def.Leafs))
 	out.Name = def.Name
 	out.Parent = parent
 	if parent != "" {
@@ -129,29 +254,52 @@ func getJson(def *Tree, list *[]JsonObject, parent string) {
 		out.Param = def.Name
 	}
 
-	for _, v := range def.Leafs {
-		fmt.Println("\t", v.Name)
-	}
-	fmt.Println("===============")
-
-	for _, v := range def.Leafs {
+	for _, v := range sortedLeafs(def) {
 		if v.Def != nil {
-			parameter := JsonParameter{Name: v.Name, FullName: v.Def.Name, Type: v.Def.Type}
+			parameter := JsonParameter{Name: v.Name, FullName: v.Def.Name, Type: v.Def.Type, Reader: readerName(v.Def)}
 			out.JsonParameters = append(out.JsonParameters, parameter)
 		}
 	}
 
-	if out.Name != "root" {
+	if out.Name != "root" || len(out.JsonParameters) > 0 {
 		*list = append(*list, out)
 	}
 
-	for _, v := range def.Leafs {
+	for _, v := range sortedLeafs(def) {
 		if v.Def == nil {
 			getJson(v, list, out.Param)
 		}
 	}
 }
 
+// getMsgpack walks the json tree and returns the name of the decoder
+// function for def. Children are appended to list before their parents so
+// that every function is defined before it is called.
+func getMsgpack(def *Tree, list *[]MsgpackObject, parent string) string {
+	var out MsgpackObject
+
+	if parent != "" {
+		out.Func = parent + "_" + def.Name
+	} else {
+		out.Func = "msgpack_object_" + def.Name
+	}
+
+	for _, v := range sortedLeafs(def) {
+		key := MsgpackKey{Name: v.Name, Len: len(v.Name)}
+		if v.Def != nil {
+			key.FullName = v.Def.Name
+			key.Reader = readerName(v.Def)
+		} else {
+			key.Func = getMsgpack(v, list, out.Func)
+		}
+		out.Keys = append(out.Keys, key)
+	}
+
+	*list = append(*list, out)
+
+	return out.Func
+}
+
 func getEnv(cfg *Config) []SetEnv {
 	envs := []SetEnv{}
 
@@ -213,55 +361,225 @@ func getParamOptions(opts []string, t string) (int, string) {
 		return len(opts), "{ " + strings.Join(opts, ", ") + "}"
 	}
 
+	quoted := make([]string, len(opts))
 	for i, v := range opts {
-		opts[i] = "\"" + v + "\""
+		quoted[i] = "\"" + v + "\""
 	}
 
-	return len(opts), "{ " + strings.Join(opts, ", ") + "}"
+	return len(quoted), "{ " + strings.Join(quoted, ", ") + "}"
 }
 
-func getCheckAndSet(cfg *Config) ([]string, []string) {
-	var out []string
+// getSetCall returns the call validating candidate c into dst, and the
+// declaration of its valid options if it has any. Strings are copied into
+// chunk when one is given.
+func getSetCall(p *Parameter, c string, dst string, chunk string) (string, string) {
+	var fn string
+	var validator string
+	if p.Type == "int" || p.Type == "string" || p.Type == "double" || p.Type == "size" {
+		optc, optv := getParamOptions(p.Options, p.Type)
+		vn := "NULL"
+		if optc > 0 {
+			vn = "valid_" + p.FlatRef
+			switch p.Type {
+			case "int":
+				validator = "const gint64 " + vn + "[] = " + optv + ";"
+			case "double":
+				validator = "const gdouble " + vn + "[] = " + optv + ";"
+			default:
+				validator = "const gchar *" + vn + "[] = " + optv + ";"
+			}
+		}
+
+		if p.Type == "string" && chunk != "" {
+			fn = fmt.Sprintf("set_string_chunk(\"%s\", %s, %s, %s, %d, %d, %d, %s, err)", p.Name, c, dst, chunk, p.Min, p.Max, optc, vn)
+		} else {
+			fn = fmt.Sprintf("set_%s(\"%s\", %s, %s, %d, %d, %d, %s, err)", p.Type, p.Name, c, dst, p.Min, p.Max, optc, vn)
+		}
+	}
+	if p.Type == "boolean" {
+		fn = fmt.Sprintf("set_%s(\"%s\", %s, %s, err)", p.Type, p.Name, c, dst)
+	}
+	if p.Type == "enum" {
+		fn = fmt.Sprintf("set_%s_%s(\"%s\", %s, %s, err)", p.Type, p.FlatRef, p.Name, c, dst)
+	}
+	if p.Type == "map" {
+		fn = fmt.Sprintf("set_%s(\"%s\", %s, %s, %d, %d, err)", readerName(p), p.Name, c, dst, p.Min, p.Max)
+	}
+	if p.Type == "file" {
+		fn = fmt.Sprintf("set_file(\"%s\", %s, %s, %d, %d, err)", p.Name, c, dst, p.Min, p.Max)
+	}
+	if p.Type == "regex" || p.Type == "glob" {
+		glob := "FALSE"
+		if p.Type == "glob" {
+			glob = "TRUE"
+		}
+		fn = fmt.Sprintf("set_pattern(\"%s\", %s, %s, %d, %d, %s, err)", p.Name, c, dst, p.Min, p.Max, glob)
+	}
+
+	return fn, validator
+}
+
+func getCheckAndSet(cfg *Config) ([]CheckAndSet, []string) {
+	var out []CheckAndSet
 	var validators []string
+	for i, p := range cfg.Parameters {
+		c := fmt.Sprintf("g_hash_table_lookup(candidates, \"%s\")", p.Name)
+		fn, validator := getSetCall(&cfg.Parameters[i], c, "&"+structRef(p), "")
+		if validator != "" {
+			validators = append(validators, validator)
+		}
+		out = append(out, CheckAndSet{Name: p.Name, Json: p.Json, Call: fn})
+	}
+
+	return out, validators
+}
+
+// getMapSample returns a C string literal holding a json object that is a
+// valid value for map p, used to build synthetic configs for benchmarks.
+func getMapSample(p *Parameter) string {
+	sample := make(map[string]interface{})
+
+	for _, f := range p.Value {
+		switch f.Type {
+		case "string", "enum":
+			if len(f.Options) > 0 {
+				sample[f.Json] = f.Options[0]
+			} else {
+				sample[f.Json] = strings.Repeat("x", f.Min)
+			}
+		case "int", "size":
+			if len(f.Options) > 0 {
+				sample[f.Json], _ = strconv.ParseInt(f.Options[0], 10, 64)
+			} else {
+				sample[f.Json] = f.Min
+			}
+		case "double":
+			if len(f.Options) > 0 {
+				sample[f.Json], _ = strconv.ParseFloat(f.Options[0], 64)
+			} else {
+				sample[f.Json] = f.Min
+			}
+		case "boolean":
+			sample[f.Json] = true
+		}
+	}
+
+	out, err := json.Marshal(sample)
+	if err != nil {
+		panic(err)
+	}
+
+	return strconv.Quote(string(out))
+}
+
+func getMaps(cfg *Config) []Map {
+	var maps []Map
+
 	for _, p := range cfg.Parameters {
-		var fn string
-		if p.Type == "int" || p.Type == "string" || p.Type == "double" || p.Type == "size" {
-			optc, optv := getParamOptions(p.Options, p.Type)
-			vn := "NULL"
-			if optc > 0 {
-				vn = "valid_" + p.FlatRef
-				switch p.Type {
-				case "int":
-					validator := "const gint64 " + vn + "[] = " + optv + ";"
-					validators = append(validators, validator)
-				case "double":
-					validator := "const gdouble " + vn + "[] = " + optv + ";"
-					validators = append(validators, validator)
-				default:
-					validator := "const gchar *" + vn + "[] = " + optv + ";"
-					validators = append(validators, validator)
-				}
+		if p.Type != "map" {
+			continue
+		}
+
+		path := strings.Split(p.Json, ".")
+		m := Map{Name: p.Name, FlatRef: p.FlatRef, JsonParents: path[:len(path)-1], JsonKey: path[len(path)-1]}
+		m.Sample = getMapSample(&p)
+		for i := range p.Value {
+			f := &p.Value[i]
+			ctype := cType(f)
+			if f.Type == "string" {
+				ctype = "const gchar *"
 			}
+			m.Fields = append(m.Fields, MapField{Name: f.Name, Json: f.Json, Type: f.Type, CType: ctype, Desc: f.Desc})
 
-			fn = fmt.Sprintf("set_%s(\"%s\", g_hash_table_lookup(candidates, \"%s\"), &%s, %d, %d, %d, %s, err)", p.Type, p.Name, p.Name, structRef(p), p.Min, p.Max, optc, vn)
+			c := fmt.Sprintf("e->fields[%d]", i)
+			if f.Default != "" {
+				dn := "default_" + f.FlatRef
+				m.Validators = append(m.Validators, fmt.Sprintf("static const struct candidate %s = { .type = CANDIDATE_STRING, .str = (gchar *) \"%s\" };", dn, f.Default))
+				c = fmt.Sprintf("%s != NULL ? %s : &%s", c, c, dn)
+			}
+			fn, validator := getSetCall(f, c, "&value."+f.Name, "dst->keys")
+			if validator != "" {
+				m.Validators = append(m.Validators, validator)
+			}
+			m.SetFields = append(m.SetFields, fn)
 		}
-		if p.Type == "boolean" {
-			fn = fmt.Sprintf("set_%s(\"%s\", g_hash_table_lookup(candidates, \"%s\"), &%s, err)", p.Type, p.Name, p.Name, structRef(p))
+		maps = append(maps, m)
+	}
+
+	return maps
+}
+
+// readerDeps holds the readers that delegate to another one.
+var readerDeps = map[string]string{"size": "int", "enum": "string", "file": "string", "glob": "regex"}
+
+// getReaders returns the value types that json and msgpack readers are
+// generated for, so that a module only gets the ones it calls.
+func getReaders(objects []JsonObject, maps []Map) map[string]bool {
+	readers := make(map[string]bool)
+	add := func(t string) {
+		readers[t] = true
+		if dep, ok := readerDeps[t]; ok {
+			readers[dep] = true
+		}
+	}
+
+	for _, o := range objects {
+		for _, p := range o.JsonParameters {
+			if p.Type != "map" {
+				add(p.Type)
+			}
 		}
-		if p.Type == "enum" {
-			fn = fmt.Sprintf("set_%s_%s(\"%s\", g_hash_table_lookup(candidates, \"%s\"), &%s, err)", p.Type, p.FlatRef, p.Name, p.Name, structRef(p))
+	}
+	for _, m := range maps {
+		for _, f := range m.Fields {
+			add(f.Type)
 		}
-		out = append(out, fn)
 	}
 
-	return out, validators
+	return readers
+}
+
+// getSetters returns the names of the set_* functions called by
+// check_and_set and the map setters.
+func getSetters(calls []CheckAndSet, maps []Map) map[string]bool {
+	setters := make(map[string]bool)
+	add := func(call string) {
+		setters[call[:strings.Index(call, "(")]] = true
+	}
+
+	for _, c := range calls {
+		add(c.Call)
+	}
+	for _, m := range maps {
+		for _, f := range m.SetFields {
+			add(f)
+		}
+	}
+
+	return setters
 }
 
-func getClear(cfg *Config) []string {
-	var out []string
+func getClear(cfg *Config) []ClearRef {
+	var out []ClearRef
 	for _, p := range cfg.Parameters {
 		if p.Type == "string" {
-			out = append(out, structRef(p))
+			out = append(out, ClearRef{Ref: structRef(p), Func: "g_free"})
+		}
+		if p.Type == "regex" || p.Type == "glob" {
+			out = append(out, ClearRef{Ref: structRef(p), Func: "g_regex_unref"})
+		}
+	}
+
+	return out
+}
+
+func getParametersOfType(cfg *Config, types ...string) []Parameter {
+	var out []Parameter
+	for _, p := range cfg.Parameters {
+		for _, t := range types {
+			if p.Type == t {
+				out = append(out, p)
+			}
 		}
 	}
 
@@ -293,6 +611,15 @@ func getOutput(cfg *Config) string {
 		case "enum":
 			format += ": %s"
 			params += fmt.Sprintf(",\n  config_name_enum_%s(%s)", v.FlatRef, structRef(v))
+		case "map":
+			format += ": %u entries"
+			params += ",\n  " + structRef(v) + ".size"
+		case "file":
+			format += ": %s (%lu bytes)"
+			params += fmt.Sprintf(",\n  %s.path,\n  %s.size", structRef(v), structRef(v))
+		case "regex", "glob":
+			format += ": %s"
+			params += fmt.Sprintf(",\n  %s ? g_regex_get_pattern(%s) : \"\"", structRef(v), structRef(v))
 		}
 		format += "\\n\"\n"
 
@@ -300,64 +627,146 @@ func getOutput(cfg *Config) string {
 	return format + params
 }
 
+func getEnum(v Parameter) Enum {
+	e := Enum{Name: v.Name, FlatRef: v.FlatRef, EnumName: "config_" + v.FlatRef, Options: []EnumOption{}}
+
+	for _, o := range v.Options {
+		name := strings.ToUpper(v.FlatRef + "_" + o)
+		name = strings.Replace(name, "-", "_", -1)
+		name = strings.Replace(name, " ", "_", -1)
+		e.Options = append(e.Options, EnumOption{NiceName: o, EnumName: name})
+	}
+
+	return e
+}
+
 func getEnums(cfg *Config) []Enum {
 	var res []Enum
 	for _, v := range cfg.Parameters {
-		if v.Type != "enum" {
-			continue
+		if v.Type == "enum" {
+			res = append(res, getEnum(v))
 		}
 
-		e := Enum{Name: v.Name, FlatRef: v.FlatRef, EnumName: "config_" + v.FlatRef, Options: []EnumOption{}}
+		for _, f := range v.Value {
+			if f.Type == "enum" {
+				res = append(res, getEnum(f))
+			}
+		}
+	}
+
+	return res
+}
 
-		for _, o := range v.Options {
-			name := strings.ToUpper(v.Name + "_" + o)
-			name = strings.Replace(name, ".", "_", -1)
-			name = strings.Replace(name, "-", "_", -1)
-			name = strings.Replace(name, " ", "_", -1)
-			e.Options = append(e.Options, EnumOption{NiceName: o, EnumName: name})
+func getAccessors(cfg *Config) []Accessor {
+	var res []Accessor
+	for _, p := range cfg.Parameters {
+		a := Accessor{Name: p.Name, FlatRef: p.FlatRef, Enum: strings.ToUpper(p.FlatRef), Type: cType(&p), Ref: structRef(p)}
+		switch p.Type {
+		case "string":
+			a.Type = "const gchar *"
+		case "regex", "glob":
+			a.Type = "const GRegex *"
+		case "map", "file":
+			a.Type = "const " + a.Type + "*"
+			a.Ref = "&" + a.Ref
 		}
-		res = append(res, e)
+		res = append(res, a)
 	}
 
 	return res
 }
 
-func mapOutput(cfg *Config, def, json *Tree) *Output {
+func modulePrefix(module string) string {
+	if module == "" {
+		return "config"
+	}
+	return "config_" + module
+}
+
+func moduleHeader(module string) string {
+	if module == "" {
+		return "config.h"
+	}
+	return "config-" + module + ".h"
+}
+
+func mapOutput(cfg *Config, def, json *Tree, opts GenOptions) *Output {
 	output := Output{}
-	output.Definitions = getDefinition(def, []Definition{})
+	output.Prefix = modulePrefix(opts.Module)
+	output.Header = moduleHeader(opts.Module)
+	output.Module = opts.Module
+	output.Definitions = getDefinition(def, output.Prefix, opts.Module != "", []Definition{})
 	output.SetEnv = getEnv(cfg)
 	output.SetDefault = getDefault(cfg)
 	output.SetOpt = getOpt(cfg)
 	output.CheckAndSet, output.ValidateOptions = getCheckAndSet(cfg)
 	output.Clear = getClear(cfg)
 	output.Enums = getEnums(cfg)
+	output.Maps = getMaps(cfg)
+	for i := range output.Maps {
+		output.Maps[i].Module = opts.Module
+	}
+	output.Patterns = getParametersOfType(cfg, "regex", "glob")
+	output.Files = getParametersOfType(cfg, "file")
 	getJson(json, &output.JsonObjects, "")
+	output.MsgpackRoot = getMsgpack(json, &output.MsgpackObjects, "")
 	output.OutputFormat = getOutput(cfg)
+	output.Readers = getReaders(output.JsonObjects, output.Maps)
+	output.Setters = getSetters(output.CheckAndSet, output.Maps)
+	if opts.Counters {
+		output.AccessCounters = true
+		output.Accessors = getAccessors(cfg)
+	}
 
 	return &output
 }
 
-func GetCFiles(cfg *Config, def, json *Tree) (string, string) {
-	t, err := template.ParseFS(templateFiles, "templates/config.c.tmpl", "templates/config.h.tmpl")
-
+func parseTemplates() *template.Template {
+	t, err := template.New("config").Funcs(template.FuncMap{"upper": strings.ToUpper}).ParseFS(templateFiles, "templates/*.tmpl")
 	if err != nil {
 		panic(err)
 	}
 
-	var cfile bytes.Buffer
-	var hfile bytes.Buffer
+	return t
+}
 
-	output := mapOutput(cfg, def, json)
+func execute(t *template.Template, name string, data interface{}) string {
+	var out bytes.Buffer
 
-	err = t.ExecuteTemplate(&cfile, "config.c.tmpl", output)
+	err := t.ExecuteTemplate(&out, name, data)
 	if err != nil {
 		panic(err)
 	}
 
-	err = t.ExecuteTemplate(&hfile, "config.h.tmpl", output)
-	if err != nil {
-		panic(err)
-	}
+	return out.String()
+}
+
+// GetCFiles generates the source and header of one schema. The maps are
+// returned for the benchmark, which covers all modules.
+func GetCFiles(cfg *Config, def, json *Tree, opts GenOptions) (string, string, *Module, []Map) {
+	t := parseTemplates()
+	output := mapOutput(cfg, def, json, opts)
+	module := &Module{Name: opts.Module, Prefix: output.Prefix, Header: output.Header}
+
+	return execute(t, "config.c.tmpl", output), execute(t, "config.h.tmpl", output), module, output.Maps
+}
+
+// GetToolFiles generates config-check.c and config-bench.c.
+func GetToolFiles(maps []Map) (string, string) {
+	t := parseTemplates()
+	output := &Output{Maps: maps}
+
+	return execute(t, "config-check.c.tmpl", output), execute(t, "config-bench.c.tmpl", output)
+}
+
+// GetComposeFiles generates the config.c and config.h that parse all
+// modules, and the config-common.c and config-common.h they share. cfg holds
+// the parameters of every module so that the sources are read only once.
+func GetComposeFiles(cfg *Config, def, json *Tree, modules []Module, counters bool) (string, string, string, string) {
+	t := parseTemplates()
+	output := mapOutput(cfg, def, json, GenOptions{Counters: counters})
+	output.Modules = modules
 
-	return cfile.String(), hfile.String()
+	return execute(t, "compose.c.tmpl", output), execute(t, "compose.h.tmpl", output),
+		execute(t, "config-common.c.tmpl", output), execute(t, "config-common.h.tmpl", output)
 }
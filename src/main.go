@@ -1,33 +1,44 @@
 package main
 
 import (
+	"bytes"
+	"flag"
 	"fmt"
 	"io/ioutil"
 	"os"
 	"path/filepath"
 	"reflect"
+	"regexp"
 	"strings"
+	"sync"
 
 	"gopkg.in/yaml.v2"
 )
 
 type Parameter struct {
-	Name     string   `yaml:"name" unique:"true"`
-	Desc     string   `yaml:"description"`
-	Default  string   `yaml:"default"`
-	Json     string   `yaml:"json" unique:"true"`
-	Env      string   `yaml:"env" unique:"true"`
-	ArgLong  string   `yaml:"arg-long" unique:"true"`
-	ArgShort string   `yaml:"arg-short" unique:"true"`
-	Type     string   `yaml:"type"`
-	Min      int      `yaml:"min"`
-	Max      int      `yaml:"max"`
-	Options  []string `yaml:"options"`
+	Name     string      `yaml:"name" unique:"true"`
+	Desc     string      `yaml:"description"`
+	Default  string      `yaml:"default"`
+	Json     string      `yaml:"json" unique:"true"`
+	Env      string      `yaml:"env" unique:"true"`
+	ArgLong  string      `yaml:"arg-long" unique:"true"`
+	ArgShort string      `yaml:"arg-short" unique:"true"`
+	Type     string      `yaml:"type"`
+	Min      int         `yaml:"min"`
+	Max      int         `yaml:"max"`
+	Options  []string    `yaml:"options"`
+	Value    []Parameter `yaml:"value"`
+	Hot      bool        `yaml:"hot"`
+	Lazy     bool        `yaml:"lazy"`
 	FlatRef  string
 }
 
 type Config struct {
+	Module     string      `yaml:"module"`
+	Include    []string    `yaml:"include"`
 	Parameters []Parameter `yaml:"parameters"`
+	File       string      `yaml:"-"`
+	Source     []byte      `yaml:"-"`
 }
 
 type Tree struct {
@@ -92,64 +103,334 @@ func validateUnique(list []Parameter) error {
 	return nil
 }
 
-func main() {
-	var cfg Config
-	var json Tree
-	var def Tree
+func convertToMsgpack(file string) error {
+	in, err := ioutil.ReadFile(file)
+	if err != nil {
+		return err
+	}
 
-	filename, _ := filepath.Abs("./config-meta.yml")
-	yamlFile, err := ioutil.ReadFile(filename)
+	out, err := JsonToMsgpack(in)
+	if err != nil {
+		return fmt.Errorf("%s: %v", file, err)
+	}
 
-	def.Leafs = make(map[string]*Tree)
-	json.Leafs = make(map[string]*Tree)
+	outFile := strings.TrimSuffix(file, filepath.Ext(file)) + ".msgpack"
 
-	def.Name = "config"
-	json.Name = "root"
+	return ioutil.WriteFile(outFile, out, 0644)
+}
 
-	err = yaml.Unmarshal(yamlFile, &cfg)
+// validateMaps checks that map parameters are only read from the config
+// file and that their values are flat structs.
+func validateMaps(list []Parameter) error {
+	for _, p := range list {
+		if p.Type != "map" {
+			if len(p.Value) > 0 {
+				return fmt.Errorf("%s has a value schema but is not a map", p.Name)
+			}
+			continue
+		}
+
+		if p.Env != "" || p.ArgLong != "" || p.ArgShort != "" || p.Default != "" {
+			return fmt.Errorf("map %s can only be set from the config file", p.Name)
+		}
+
+		if len(p.Value) == 0 {
+			return fmt.Errorf("map %s has no value schema", p.Name)
+		}
+
+		fields := make(map[string]bool)
+		for _, f := range p.Value {
+			if f.Type == "map" || len(f.Value) > 0 {
+				return fmt.Errorf("map %s can not contain nested maps", p.Name)
+			}
+			if f.Type == "regex" || f.Type == "glob" || f.Type == "file" {
+				return fmt.Errorf("map %s can only contain scalar values", p.Name)
+			}
+			if fields[f.Name] {
+				return fmt.Errorf("map %s has duplicate field: %s", p.Name, f.Name)
+			}
+			fields[f.Name] = true
+		}
+	}
+
+	return nil
+}
+
+var nonIdent = regexp.MustCompile(`[^a-z0-9_]`)
+var moduleName = regexp.MustCompile(`^[a-z_][a-z0-9_]*$`)
+
+// loadSchema reads file and, depth first, the schemas it includes. Paths
+// are relative to the including file and every file is read once.
+func loadSchema(file string, seen map[string]bool, list *[]*Config) error {
+	abs, err := filepath.Abs(file)
 	if err != nil {
-		panic(err)
+		return err
+	}
+	if seen[abs] {
+		return nil
 	}
+	seen[abs] = true
 
-	uniqueErr := validateUnique(cfg.Parameters)
-	if uniqueErr != nil {
+	in, err := ioutil.ReadFile(file)
+	if err != nil {
+		return err
+	}
 
-		fmt.Println(uniqueErr)
-		os.Exit(1)
+	cfg := &Config{}
+	err = yaml.Unmarshal(in, cfg)
+	if err != nil {
+		return fmt.Errorf("%s: %v", file, err)
+	}
+
+	cfg.File = file
+	cfg.Source = in
+	if cfg.Module == "" {
+		stem := strings.TrimSuffix(filepath.Base(file), filepath.Ext(file))
+		cfg.Module = nonIdent.ReplaceAllString(strings.ToLower(stem), "_")
+	}
+	*list = append(*list, cfg)
+
+	for _, inc := range cfg.Include {
+		if !filepath.IsAbs(inc) {
+			inc = filepath.Join(filepath.Dir(file), inc)
+		}
+		if err := loadSchema(inc, seen, list); err != nil {
+			return err
+		}
+	}
+
+	return nil
+}
+
+// validateModules checks that module names are unique and do not clash
+// with the config_<name> types generated for parameters.
+func validateModules(modules []*Config, all []Parameter) error {
+	names := make(map[string]string)
+
+	for _, p := range all {
+		names[strings.ReplaceAll(p.Name, ".", "_")] = "parameter " + p.Name
 	}
 
+	for _, m := range modules {
+		if !moduleName.MatchString(m.Module) {
+			return fmt.Errorf("%s: invalid module name: %s", m.File, m.Module)
+		}
+		if other, exists := names[m.Module]; exists {
+			return fmt.Errorf("%s: module %s clashes with %s", m.File, m.Module, other)
+		}
+		names[m.Module] = "module in " + m.File
+	}
+
+	return nil
+}
+
+// prepare sets the derived names of the parameters of cfg and returns its
+// struct and json trees.
+func prepare(cfg *Config, name string) (*Tree, *Tree) {
+	def := &Tree{Name: name, Leafs: make(map[string]*Tree)}
+	json := &Tree{Name: "root", Leafs: make(map[string]*Tree)}
+
 	for i, p := range cfg.Parameters {
-		fmt.Println(p.Name)
 		cfg.Parameters[i].FlatRef = fmt.Sprintf("%s", strings.ReplaceAll(p.Name, ".", "_"))
 
-		add_to_tree(&def, p.Name, &cfg.Parameters[i])
-		add_to_tree(&json, p.Json, &cfg.Parameters[i])
-	}
+		for j, f := range p.Value {
+			cfg.Parameters[i].Value[j].FlatRef = cfg.Parameters[i].FlatRef + "_" + f.Name
+			if f.Json == "" {
+				cfg.Parameters[i].Value[j].Json = f.Name
+			}
+		}
 
-	fmt.Println("======== NEW ===========")
+		add_to_tree(def, p.Name, &cfg.Parameters[i])
+		add_to_tree(json, p.Json, &cfg.Parameters[i])
+	}
 
-	cfile, hfile := GetCFiles(&cfg, &def, &json)
+	return def, json
+}
 
-	cout, err := os.Create("testapp/config.c")
+// writeOutput writes content to file unless it already has that content,
+// so that unchanged modules are not rebuilt.
+func writeOutput(file string, content string) {
+	old, err := ioutil.ReadFile(file)
+	if err == nil && bytes.Equal(old, []byte(content)) {
+		return
+	}
 
+	err = ioutil.WriteFile(file, []byte(content), 0644)
 	if err != nil {
 		fmt.Println(err)
-	} else {
-		cout.WriteString(cfile)
 	}
+}
 
-	cout.Close()
+// writeSources writes the list of generated units that meson.build reads,
+// and removes the units of modules that were in the previous list but are
+// no longer in the schema.
+func writeSources(file string, units []string) {
+	old, err := ioutil.ReadFile(file)
+	if err == nil {
+		keep := make(map[string]bool)
+		for _, u := range units {
+			keep[u] = true
+		}
 
-	hout, err := os.Create("testapp/config.h")
+		for _, u := range strings.Fields(string(old)) {
+			if keep[u] {
+				continue
+			}
+			for _, f := range []string{u, strings.TrimSuffix(u, ".c") + ".h"} {
+				err := os.Remove(filepath.Join(filepath.Dir(file), f))
+				if err != nil && !os.IsNotExist(err) {
+					fmt.Println(err)
+				}
+			}
+		}
+	}
+
+	writeOutput(file, strings.Join(units, "\n")+"\n")
+}
 
+func main() {
+	var schemas []*Config
+	var all Config
+
+	toMsgpack := flag.Bool("to-msgpack", false, "convert the given json config files to msgpack and exit")
+	counters := flag.Bool("access-counters", false, "generate config_get_* accessors that count reads per parameter")
+	report := flag.String("access-report", "", "suggest hot and lazy annotations from a config_access_report() dump and exit")
+	apply := flag.Bool("apply", false, "with -access-report, write the annotations to the schema files")
+	flag.Parse()
+
+	if *toMsgpack {
+		for _, f := range flag.Args() {
+			if err := convertToMsgpack(f); err != nil {
+				fmt.Println(err)
+				os.Exit(1)
+			}
+		}
+		return
+	}
+
+	err := loadSchema("./config-meta.yml", make(map[string]bool), &schemas)
 	if err != nil {
-		fmt.Println(err)
+		panic(err)
+	}
+
+	for _, s := range schemas {
+		all.Parameters = append(all.Parameters, s.Parameters...)
+	}
+
+	// Uniqueness is checked across all modules since they share the
+	// environment, the command line and the config file.
+	uniqueErr := validateUnique(all.Parameters)
+	if uniqueErr != nil {
+
+		fmt.Println(uniqueErr)
+		os.Exit(1)
+	}
+
+	mapErr := validateMaps(all.Parameters)
+	if mapErr != nil {
+		fmt.Println(mapErr)
+		os.Exit(1)
+	}
+
+	annotationErr := validateAnnotations(all.Parameters)
+	if annotationErr != nil {
+		fmt.Println(annotationErr)
+		os.Exit(1)
+	}
+
+	if *report != "" {
+		counts, err := readAccessReport(*report)
+		if err != nil {
+			fmt.Println(err)
+			os.Exit(1)
+		}
+
+		annotations := suggestAnnotations(&all, counts)
+		for _, c := range counts {
+			if a := annotations[c.Name]; a != "" {
+				fmt.Printf("%s: %s (%d reads)\n", c.Name, a, c.Count)
+			}
+		}
+
+		if *apply {
+			for _, s := range schemas {
+				writeOutput(s.File, string(applyAnnotations(s.Source, annotations)))
+			}
+		}
+		return
+	}
+
+	var maps []Map
+	units := []string{"config.c"}
+
+	if len(schemas[0].Include) == 0 {
+		def, json := prepare(schemas[0], "config")
+
+		cfile, hfile, _, m := GetCFiles(schemas[0], def, json, GenOptions{Counters: *counters})
+		writeOutput("testapp/config.c", cfile)
+		writeOutput("testapp/config.h", hfile)
+		maps = m
 	} else {
-		hout.WriteString(hfile)
+		var modules []*Config
+		for _, s := range schemas {
+			if len(s.Parameters) > 0 {
+				modules = append(modules, s)
+			}
+		}
+
+		moduleErr := validateModules(modules, all.Parameters)
+		if moduleErr != nil {
+			fmt.Println(moduleErr)
+			os.Exit(1)
+		}
+
+		var union Config
+		defs := make([]*Tree, len(modules))
+		jsons := make([]*Tree, len(modules))
+		for i, m := range modules {
+			defs[i], jsons[i] = prepare(m, modulePrefix(m.Module))
+			union.Parameters = append(union.Parameters, m.Parameters...)
+		}
+		unionDef, unionJson := prepare(&union, "config")
+
+		var wg sync.WaitGroup
+		refs := make([]Module, len(modules))
+		moduleMaps := make([][]Map, len(modules))
+		for i, m := range modules {
+			wg.Add(1)
+			go func(i int, m *Config) {
+				defer wg.Done()
+
+				cfile, hfile, ref, mm := GetCFiles(m, defs[i], jsons[i], GenOptions{Counters: *counters, Module: m.Module})
+				writeOutput("testapp/config-"+m.Module+".c", cfile)
+				writeOutput("testapp/config-"+m.Module+".h", hfile)
+				refs[i] = *ref
+				moduleMaps[i] = mm
+			}(i, m)
+		}
+		wg.Wait()
+
+		for _, mm := range moduleMaps {
+			maps = append(maps, mm...)
+		}
+
+		cfile, hfile, commonc, commonh := GetComposeFiles(&union, unionDef, unionJson, refs, *counters)
+		writeOutput("testapp/config.c", cfile)
+		writeOutput("testapp/config.h", hfile)
+		writeOutput("testapp/config-common.c", commonc)
+		writeOutput("testapp/config-common.h", commonh)
+
+		units = append(units, "config-common.c")
+		for _, m := range modules {
+			units = append(units, "config-"+m.Module+".c")
+		}
 	}
 
-	hout.Close()
+	checkfile, benchfile := GetToolFiles(maps)
+	writeOutput("testapp/config-check.c", checkfile)
+	writeOutput("testapp/config-bench.c", benchfile)
+	writeSources("testapp/config-sources.txt", units)
 
-	fmt.Printf(getReadme(&cfg))
+	fmt.Printf(getReadme(&all))
 
 }
@@ -0,0 +1,137 @@
+package main
+
+import (
+	"bytes"
+	"encoding/binary"
+	"encoding/json"
+	"fmt"
+	"math"
+	"sort"
+	"strconv"
+)
+
+// JsonToMsgpack converts a json configuration into the msgpack encoding
+// read by the generated parse_msgpack_file(). Integers stay integers and
+// object keys are written in sorted order so the output is reproducible.
+func JsonToMsgpack(in []byte) ([]byte, error) {
+	var v interface{}
+	var out bytes.Buffer
+
+	dec := json.NewDecoder(bytes.NewReader(in))
+	dec.UseNumber()
+
+	if err := dec.Decode(&v); err != nil {
+		return nil, err
+	}
+
+	if err := writeMsgpack(&out, v); err != nil {
+		return nil, err
+	}
+
+	return out.Bytes(), nil
+}
+
+func writeMsgpackStrHeader(out *bytes.Buffer, n int) {
+	switch {
+	case n <= 31:
+		out.WriteByte(0xa0 | byte(n))
+	case n <= math.MaxUint8:
+		out.WriteByte(0xd9)
+		out.WriteByte(byte(n))
+	case n <= math.MaxUint16:
+		out.WriteByte(0xda)
+		binary.Write(out, binary.BigEndian, uint16(n))
+	default:
+		out.WriteByte(0xdb)
+		binary.Write(out, binary.BigEndian, uint32(n))
+	}
+}
+
+// writeMsgpackContainerHeader writes an array or map header, fix being
+// the fixarray/fixmap prefix and base the 16 bit variant.
+func writeMsgpackContainerHeader(out *bytes.Buffer, fix byte, base byte, n int) {
+	switch {
+	case n <= 15:
+		out.WriteByte(fix | byte(n))
+	case n <= math.MaxUint16:
+		out.WriteByte(base)
+		binary.Write(out, binary.BigEndian, uint16(n))
+	default:
+		out.WriteByte(base + 1)
+		binary.Write(out, binary.BigEndian, uint32(n))
+	}
+}
+
+func writeMsgpackInt(out *bytes.Buffer, i int64) {
+	switch {
+	case i >= 0 && i <= math.MaxInt8:
+		out.WriteByte(byte(i))
+	case i < 0 && i >= -32:
+		out.WriteByte(byte(i))
+	case i >= math.MinInt8 && i <= math.MaxInt8:
+		out.WriteByte(0xd0)
+		out.WriteByte(byte(i))
+	case i >= math.MinInt16 && i <= math.MaxInt16:
+		out.WriteByte(0xd1)
+		binary.Write(out, binary.BigEndian, int16(i))
+	case i >= math.MinInt32 && i <= math.MaxInt32:
+		out.WriteByte(0xd2)
+		binary.Write(out, binary.BigEndian, int32(i))
+	default:
+		out.WriteByte(0xd3)
+		binary.Write(out, binary.BigEndian, i)
+	}
+}
+
+func writeMsgpack(out *bytes.Buffer, v interface{}) error {
+	switch val := v.(type) {
+	case nil:
+		out.WriteByte(0xc0)
+	case bool:
+		if val {
+			out.WriteByte(0xc3)
+		} else {
+			out.WriteByte(0xc2)
+		}
+	case json.Number:
+		if i, err := strconv.ParseInt(val.String(), 10, 64); err == nil {
+			writeMsgpackInt(out, i)
+		} else if u, err := strconv.ParseUint(val.String(), 10, 64); err == nil {
+			out.WriteByte(0xcf)
+			binary.Write(out, binary.BigEndian, u)
+		} else if f, err := val.Float64(); err == nil {
+			out.WriteByte(0xcb)
+			binary.Write(out, binary.BigEndian, math.Float64bits(f))
+		} else {
+			return fmt.Errorf("invalid number: %s", val)
+		}
+	case string:
+		writeMsgpackStrHeader(out, len(val))
+		out.WriteString(val)
+	case []interface{}:
+		writeMsgpackContainerHeader(out, 0x90, 0xdc, len(val))
+		for _, e := range val {
+			if err := writeMsgpack(out, e); err != nil {
+				return err
+			}
+		}
+	case map[string]interface{}:
+		keys := make([]string, 0, len(val))
+		for k := range val {
+			keys = append(keys, k)
+		}
+		sort.Strings(keys)
+
+		writeMsgpackContainerHeader(out, 0x80, 0xde, len(val))
+		for _, k := range keys {
+			writeMsgpack(out, k)
+			if err := writeMsgpack(out, val[k]); err != nil {
+				return err
+			}
+		}
+	default:
+		return fmt.Errorf("unsupported json value: %v", val)
+	}
+
+	return nil
+}
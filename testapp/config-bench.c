@@ -0,0 +1,271 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <jansson.h>
+#include <stdio.h>
+
+#include "config.h"
+
+static gint entries = 100000;
+static gint rounds = 10;
+static gint checks = 10000;
+static gint jobs = 0;
+
+static GOptionEntry options[] =
+{
+  { "entries", 'n', 0, G_OPTION_ARG_INT, &entries, "Number of entries in each map (default: 100000)", NULL },
+  { "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds, "Number of times each measurement is repeated (default: 10)", NULL },
+  { "checks", 'c', 0, G_OPTION_ARG_INT, &checks, "Number of distinct files validated for the check throughput (default: 10000)", NULL },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Number of files validated in parallel (default: number of cpus)", NULL },
+  { NULL }
+};
+
+static gdouble
+now_ns(void)
+{
+  return g_get_monotonic_time() * 1000.0;
+}
+
+static gboolean
+write_config(const gchar *path, json_t *root, GError **err)
+{
+  if (json_dump_file(root, path, JSON_COMPACT) != 0) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not write %s",
+                path);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+bench_routes(const gchar *path, gchar **keys, gchar **missing, GError **err)
+{
+  struct config cfg = {};
+  json_t *root = NULL;
+  json_t *obj = NULL;
+  json_t *map = NULL;
+  json_t *sample = NULL;
+  gdouble start;
+  gdouble build;
+  gdouble hit;
+  gdouble miss;
+  volatile guint found = 0;
+
+  root = json_object();
+  obj = root;
+
+  map = json_object();
+  sample = json_loads("{\"backend\":\"x\",\"mode\":\"fast\",\"weight\":0}", 0, NULL);
+  g_assert(sample);
+  for (gint i = 0; i < entries; i++) {
+    json_object_set(map, keys[i], sample);
+  }
+  json_decref(sample);
+  json_object_set_new(obj, "routes", map);
+
+  if (!write_config(path, root, err)) {
+    json_decref(root);
+    return FALSE;
+  }
+  json_decref(root);
+
+  start = now_ns();
+  for (gint r = 0; r < rounds; r++) {
+    config_clear(&cfg);
+    if (!config_parse_file(&cfg, path, err)) {
+      return FALSE;
+    }
+  }
+  build = (now_ns() - start) / rounds;
+
+  start = now_ns();
+  for (gint r = 0; r < rounds; r++) {
+    for (gint i = 0; i < entries; i++) {
+      found += config_lookup_routes(&cfg.network, keys[i]) != NULL;
+    }
+  }
+  hit = (now_ns() - start) / ((gdouble) rounds * entries);
+
+  start = now_ns();
+  for (gint r = 0; r < rounds; r++) {
+    for (gint i = 0; i < entries; i++) {
+      found += config_lookup_routes(&cfg.network, missing[i]) != NULL;
+    }
+  }
+  miss = (now_ns() - start) / ((gdouble) rounds * entries);
+
+  g_print("routes: %u entries, build %.2f ms, lookup hit %.1f ns, miss %.1f ns\n",
+          cfg.network.routes.size, build / 1000000.0, hit, miss);
+  config_clear(&cfg);
+
+  return found == (guint) rounds * entries;
+}
+
+static void
+count_error(const gchar *json, const GError *error, gpointer user_data)
+{
+  g_atomic_int_inc((gint *) user_data);
+}
+
+static void
+check_one(gpointer data, gpointer user_data)
+{
+  (void) config_check_file(data, count_error, user_data);
+}
+
+/* A small config with a few entries in every map, starting at keys[offset]
+ * so that no two files are the same. */
+static gboolean
+write_check_config(const gchar *path, gchar **keys, gint offset, GError **err)
+{
+  json_t *root = NULL;
+  json_t *obj = NULL;
+  json_t *map = NULL;
+  json_t *sample = NULL;
+  gboolean ok;
+
+  root = json_object();
+
+  obj = root;
+  map = json_object();
+  sample = json_loads("{\"backend\":\"x\",\"mode\":\"fast\",\"weight\":0}", 0, NULL);
+  g_assert(sample);
+  for (gint i = 0; i < MIN(entries, 10); i++) {
+    json_object_set(map, keys[(offset + i) % entries], sample);
+  }
+  json_decref(sample);
+  json_object_set_new(obj, "routes", map);
+
+  ok = write_config(path, root, err);
+  json_decref(root);
+
+  return ok;
+}
+
+/* Validates distinct files on a thread pool, the way config-check does, so
+ * that per-file costs are not hidden by validating one file repeatedly. */
+static gboolean
+bench_check(gchar **keys, GError **err)
+{
+  GThreadPool *pool = NULL;
+  gchar **files = NULL;
+  gchar *dir = NULL;
+  gdouble start;
+  gdouble elapsed;
+  gint errors = 0;
+  gboolean ok = FALSE;
+
+  dir = g_dir_make_tmp("config-bench-XXXXXX", err);
+  if (dir == NULL) {
+    return FALSE;
+  }
+
+  files = g_new0(gchar *, checks + 1);
+  for (gint f = 0; f < checks; f++) {
+    files[f] = g_strdup_printf("%s/%d.json", dir, f);
+    if (!write_check_config(files[f], keys, f, err)) {
+      goto out;
+    }
+  }
+
+  pool = g_thread_pool_new(check_one, &errors, jobs, FALSE, err);
+  if (pool == NULL) {
+    goto out;
+  }
+
+  start = now_ns();
+  for (gint f = 0; f < checks; f++) {
+    (void) g_thread_pool_push(pool, files[f], NULL);
+  }
+  g_thread_pool_free(pool, FALSE, TRUE);
+  elapsed = now_ns() - start;
+
+  if (errors > 0) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "%d errors in the generated configs",
+                errors);
+    goto out;
+  }
+
+  g_print("check: %d files, %d jobs, %.0f files/s\n",
+          checks, jobs, checks / (elapsed / 1000000000.0));
+  ok = TRUE;
+
+out:
+  for (gint f = 0; f < checks && files[f] != NULL; f++) {
+    g_unlink(files[f]);
+  }
+  g_rmdir(dir);
+  g_strfreev(files);
+  g_free(dir);
+
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+    GOptionContext *context = NULL;
+    GError *err = NULL;
+    gchar *path = NULL;
+    gchar **keys = NULL;
+    gchar **missing = NULL;
+    gint fd;
+    int res = 0;
+
+    context = g_option_context_new("");
+    g_option_context_set_summary(context,
+                                 "Measure build time and lookup latency of the map parameters, and how\n"
+                                 "many files per second are validated in parallel.");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &err) || entries <= 0 || rounds <= 0 || checks <= 0 || jobs < 0) {
+        g_printerr("%s\n", err ? err->message : "Invalid arguments");
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return 2;
+    }
+    g_option_context_free(context);
+
+    if (jobs == 0) {
+        jobs = g_get_num_processors();
+    }
+
+    fd = g_file_open_tmp("config-bench-XXXXXX.json", &path, &err);
+    if (fd < 0) {
+        g_printerr("%s\n", err->message);
+        g_clear_error(&err);
+        return 2;
+    }
+    g_close(fd, NULL);
+
+    keys = g_new0(gchar *, entries + 1);
+    missing = g_new0(gchar *, entries + 1);
+    for (gint i = 0; i < entries; i++) {
+        keys[i] = g_strdup_printf("key-%d", i);
+        missing[i] = g_strdup_printf("missing-%d", i);
+    }
+
+    if (res == 0 && !bench_routes(path, keys, missing, &err)) {
+        g_printerr("routes: %s\n", err ? err->message : "lookup failed");
+        g_clear_error(&err);
+        res = 1;
+    }
+
+    if (res == 0 && !bench_check(keys, &err)) {
+        g_printerr("check: %s\n", err->message);
+        g_clear_error(&err);
+        res = 1;
+    }
+
+    g_unlink(path);
+    g_free(path);
+    g_strfreev(keys);
+    g_strfreev(missing);
+
+    return res;
+}
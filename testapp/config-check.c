@@ -0,0 +1,199 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+struct check_ctx {
+  GMutex lock;
+  gint failed;
+};
+
+static gint jobs = 0;
+
+static GOptionEntry entries[] =
+{
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Number of files validated in parallel (default: number of cpus)", NULL },
+  { NULL }
+};
+
+static void
+append_json_string(GString *out, const gchar *str)
+{
+  g_string_append_c(out, '"');
+  for (const gchar *p = str; *p != '\0'; p++) {
+    switch (*p) {
+    case '"':
+      g_string_append(out, "\\\"");
+      break;
+    case '\\':
+      g_string_append(out, "\\\\");
+      break;
+    case '\n':
+      g_string_append(out, "\\n");
+      break;
+    case '\t':
+      g_string_append(out, "\\t");
+      break;
+    default:
+      if ((guchar) *p < 0x20) {
+        g_string_append_printf(out, "\\u%04x", (guchar) *p);
+      } else {
+        g_string_append_c(out, *p);
+      }
+    }
+  }
+  g_string_append_c(out, '"');
+}
+
+static void
+report_error(const gchar *json, const GError *error, gpointer user_data)
+{
+  GString *line = user_data;
+
+  if (line->str[line->len - 1] != '[') {
+    g_string_append_c(line, ',');
+  }
+  g_string_append(line, "{\"path\":");
+  append_json_string(line, json);
+  g_string_append(line, ",\"error\":");
+  append_json_string(line, error->message);
+  g_string_append_c(line, '}');
+}
+
+static void
+check_file(gpointer data, gpointer user_data)
+{
+  gchar *file = data;
+  struct check_ctx *ctx = user_data;
+  GString *line = NULL;
+  gboolean ok;
+
+  line = g_string_sized_new(256);
+  g_string_append(line, "{\"file\":");
+  append_json_string(line, file);
+  g_string_append(line, ",\"errors\":[");
+
+  ok = config_check_file(file, report_error, line);
+  if (!ok) {
+    g_atomic_int_inc(&ctx->failed);
+  }
+
+  g_string_append_printf(line, "],\"ok\":%s}\n", ok ? "true" : "false");
+
+  g_mutex_lock(&ctx->lock);
+  fwrite(line->str, 1, line->len, stdout);
+  g_mutex_unlock(&ctx->lock);
+
+  g_string_free(line, TRUE);
+  g_free(file);
+}
+
+/* Directories are keyed by device and inode in visited, so that one
+ * reached again through a symlink is skipped and symlink loops end. */
+static gboolean
+push_path(GThreadPool *pool, GHashTable *visited, const gchar *path, gboolean explicit, GError **err)
+{
+  GDir *dir = NULL;
+  GStatBuf st;
+  const gchar *name;
+
+  g_assert(pool);
+  g_assert(visited);
+  g_assert(path);
+  g_assert(err != NULL && *err == NULL);
+
+  if (g_stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    if (explicit || g_str_has_suffix(path, ".json") || g_str_has_suffix(path, ".msgpack")) {
+      return g_thread_pool_push(pool, g_strdup(path), err);
+    }
+    return TRUE;
+  }
+
+  if (!g_hash_table_add(visited, g_strdup_printf("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT,
+                                                 (guint64) st.st_dev, (guint64) st.st_ino))) {
+    return TRUE;
+  }
+
+  dir = g_dir_open(path, 0, err);
+  if (dir == NULL) {
+    return FALSE;
+  }
+
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    gchar *child = g_build_filename(path, name, NULL);
+    gboolean ok = push_path(pool, visited, child, FALSE, err);
+
+    g_free(child);
+    if (!ok) {
+      g_dir_close(dir);
+      return FALSE;
+    }
+  }
+
+  g_dir_close(dir);
+
+  return TRUE;
+}
+
+int
+main(int argc, char** argv)
+{
+    GOptionContext *context = NULL;
+    GThreadPool *pool = NULL;
+    GHashTable *visited = NULL;
+    struct check_ctx ctx = {};
+    GError *err = NULL;
+    int res = 0;
+
+    context = g_option_context_new("FILE|DIR...");
+    g_option_context_set_summary(context,
+                                 "Validate configuration files, printing one json line per file.");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_clear_error(&err);
+        g_option_context_free(context);
+        return 2;
+    }
+    g_option_context_free(context);
+
+    if (argc < 2) {
+        g_printerr("No files given\n");
+        return 2;
+    }
+
+    if (jobs <= 0) {
+        jobs = g_get_num_processors();
+    }
+
+    g_mutex_init(&ctx.lock);
+    pool = g_thread_pool_new(check_file, &ctx, jobs, FALSE, &err);
+    if (pool == NULL) {
+        g_printerr("Could not create thread pool: %s\n", err->message);
+        g_clear_error(&err);
+        return 2;
+    }
+
+    visited = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (gint i = 1; i < argc; i++) {
+        if (!push_path(pool, visited, argv[i], TRUE, &err)) {
+            g_printerr("Could not read %s: %s\n", argv[i], err->message);
+            g_clear_error(&err);
+            res = 2;
+        }
+    }
+
+    g_hash_table_unref(visited);
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_mutex_clear(&ctx.lock);
+    fflush(stdout);
+
+    if (res == 0 && g_atomic_int_get(&ctx.failed) > 0) {
+        res = 1;
+    }
+
+    return res;
+}
@@ -0,0 +1,7 @@
+#include "config-common.h"
+
+GQuark
+config_error_quark(void)
+{
+  return g_quark_from_static_string ("xxconfig-error-quark");
+}
@@ -0,0 +1,28 @@
+#ifndef _CONFIG_COMMON_H_
+#define _CONFIG_COMMON_H_
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#define CONFIG_ERROR config_error_quark()
+#define ERROR_CONFIG_NOT_SET 1
+#define ERROR_CONFIG_TOO_BIG 2
+#define ERROR_CONFIG_TOO_SMALL 3
+#define ERROR_CONFIG_INVALID 4
+#define ERROR_CONFIG_NO_FILE 5
+
+/* A read-only mapping of a file parameter, valid until config_clear. */
+struct config_file {
+  const gchar *data;
+  gsize size;
+  gchar *path;
+  GMappedFile *map;
+};
+
+/* Called once per failing parameter with its json path, or with an empty
+ * path when the file itself could not be read. */
+typedef void (*config_error_func)(const gchar *json, const GError *error, gpointer user_data);
+
+GQuark
+config_error_quark(void);
+#endif /* _CONFIG_COMMON_H_ */
@@ -0,0 +1,1840 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <jansson.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "config-core.h"
+
+/* Numbers read from json or msgpack are kept in their native type so they
+ * do not take a trip through a string before being validated. A value of
+ * the wrong type is kept as invalid, with the reason in str, so that it is
+ * reported instead of falling back to the default. */
+enum candidate_type {
+  CANDIDATE_STRING,
+  CANDIDATE_INT,
+  CANDIDATE_DOUBLE,
+  CANDIDATE_MAP,
+  CANDIDATE_INVALID
+};
+
+struct candidate {
+  enum candidate_type type;
+  gchar *str;
+  gint64 i;
+  gdouble d;
+  gchar **strv;
+  GPtrArray *entries;
+};
+
+/* One entry of a map candidate, fields are indexed in schema order. An
+ * entry that is not an object is kept as invalid so that it is reported. */
+struct candidate_entry {
+  gchar *key;
+  gboolean invalid;
+  guint n_fields;
+  struct candidate **fields;
+};
+
+static void
+candidate_free(gpointer data)
+{
+  struct candidate *c = data;
+
+  if (c == NULL) {
+    return;
+  }
+
+  g_free(c->str);
+  g_strfreev(c->strv);
+  if (c->entries != NULL) {
+    g_ptr_array_unref(c->entries);
+  }
+  g_free(c);
+}
+
+static struct candidate *
+candidate_new_string(gchar *value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_STRING;
+  c->str = value;
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_int(gint64 value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_INT;
+  c->i = value;
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_double(gdouble value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_DOUBLE;
+  c->d = value;
+
+  return c;
+}
+
+static struct candidate * G_GNUC_PRINTF(1, 2)
+candidate_new_invalid(const gchar *format, ...)
+{
+  struct candidate *c = NULL;
+  va_list args;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_INVALID;
+  va_start(args, format);
+  c->str = g_strdup_vprintf(format, args);
+  va_end(args);
+
+  return c;
+}
+
+static void
+put_candidate(GHashTable *candidates, gchar *name, struct candidate *c)
+{
+  g_assert(candidates);
+  g_assert(name);
+
+  if (c == NULL) {
+    return;
+  }
+
+  (void) g_hash_table_replace(candidates, (gpointer)name, (gpointer)c);
+}
+
+static void
+set_candidate(GHashTable *candidates, gchar *name, gchar *value)
+{
+  if (value == NULL) {
+    return;
+  }
+
+  put_candidate(candidates, name, candidate_new_string(value));
+}
+
+
+static void
+set_env_var(GHashTable *candidates, const gchar *name, const gchar *env)
+{
+  const gchar *tmp;
+
+  g_assert(candidates);
+  g_assert(name);
+  g_assert(env);
+
+  tmp = g_getenv(env);
+  set_candidate(candidates, (gchar *)name, g_strdup(tmp));
+}
+
+static gboolean
+set_env(GHashTable *candidates)
+{
+  g_assert(candidates);
+
+  set_env_var(candidates, "main.second", "SECOND_VAR");
+
+  set_env_var(candidates, "main.deep.enumtest", "enum-test");
+
+  return TRUE;
+}
+
+
+
+static gboolean
+set_defaults(GHashTable *candidates)
+{
+  g_assert(candidates);
+  set_candidate(candidates, "main.first", g_strdup("Just a string"));
+  set_candidate(candidates, "main.second", g_strdup("7"));
+  set_candidate(candidates, "main.third", g_strdup("FALSE"));
+  set_candidate(candidates, "main.double_param", g_strdup("13.5"));
+  set_candidate(candidates, "main.size", g_strdup("10 mb"));
+  set_candidate(candidates, "main.deep.param", g_strdup("hello"));
+  set_candidate(candidates, "main.deep.enumtest", g_strdup("hello"));
+  set_candidate(candidates, "main.deep.params", g_strdup("Just a string"));
+  set_candidate(candidates, "other", g_strdup("Just a string"));
+
+  return TRUE;
+}
+
+static gboolean
+parse_opts(GHashTable *candidates, gint *argc, gchar **argv[], GError **err)
+{
+  GOptionContext *context;
+  gchar *main_first = NULL;
+  gchar *main_second = NULL;
+  gboolean main_third = FALSE;
+  gchar *main_double_param = NULL;
+  gchar *main_size = NULL;
+  gchar *main_deep_enumtest = NULL;
+  GOptionEntry entries[] =
+  {
+    { "first", 'f', 0 , G_OPTION_ARG_STRING, &main_first, "This is a variable", NULL },
+    { "second", 'e', 0 , G_OPTION_ARG_STRING, &main_second, "", NULL },
+    { "third", 't', 0 , G_OPTION_ARG_NONE, &main_third, "", NULL },
+    { "test-double", 'd', 0 , G_OPTION_ARG_STRING, &main_double_param, "", NULL },
+    { "test-size", 's', 0 , G_OPTION_ARG_STRING, &main_size, "", NULL },
+    { "enum-test", 'g', 0 , G_OPTION_ARG_STRING, &main_deep_enumtest, "", NULL },
+    { NULL }
+  };
+
+  g_assert(candidates);
+  g_assert(err != NULL && *err == NULL);
+
+  context = g_option_context_new ("");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, argc, argv, err)) {
+    return FALSE;
+  }
+  set_candidate(candidates, "main.first", main_first);
+  set_candidate(candidates, "main.second", main_second);
+  if (main_third) {
+    set_candidate(candidates, "main.third", g_strdup("TRUE"));
+  }
+  set_candidate(candidates, "main.double_param", main_double_param);
+  set_candidate(candidates, "main.size", main_size);
+  set_candidate(candidates, "main.deep.enumtest", main_deep_enumtest);
+
+  return TRUE;
+}
+static gchar *
+get_config_file()
+{
+  if (g_file_test("./config.msgpack", G_FILE_TEST_IS_REGULAR)) {
+    return g_strdup("./config.msgpack");
+  }
+  return g_strdup("./config.json");
+}
+
+static struct candidate *
+json_string_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
+  }
+
+  return candidate_new_invalid("expected a string");
+}
+
+static struct candidate *
+json_int_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
+  }
+  if (json_is_integer(val)) {
+    return candidate_new_int(json_integer_value(val));
+  }
+
+  return candidate_new_invalid("expected an integer or a string");
+}
+
+static struct candidate *
+json_size_candidate(json_t *val)
+{
+  return json_int_candidate(val);
+}
+
+static struct candidate *
+json_double_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
+  }
+  if (json_is_number(val)) {
+    return candidate_new_double(json_number_value(val));
+  }
+
+  return candidate_new_invalid("expected a number or a string");
+}
+
+static struct candidate *
+json_enum_candidate(json_t *val)
+{
+  return json_string_candidate(val);
+}
+
+static struct candidate *
+json_boolean_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_boolean(val)) {
+    return candidate_new_string(g_strdup(json_is_true(val) ? "TRUE" : "FALSE"));
+  }
+
+  return candidate_new_invalid("expected a boolean");
+}
+
+
+static void
+json_init(void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized)) {
+    json_set_alloc_funcs(g_malloc, g_free);
+    g_once_init_leave(&initialized, 1);
+  }
+}
+
+static gboolean
+parse_json_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  json_error_t j_error;
+  json_t *root = NULL;
+  json_t *root_main = NULL;
+  json_t *root_main_deep = NULL;
+
+  g_assert(candidates);
+  g_assert(file);
+
+  json_init();
+  root = json_load_file(file, 0, &j_error);
+
+  if (root == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: %s",
+                file,
+                j_error.text);
+    return FALSE;
+  }
+  if (root != NULL) {
+    root_main = json_object_get(root, "main");
+  }
+  if (root_main != NULL) {
+    root_main_deep = json_object_get(root_main, "deep");
+  }
+  if (root != NULL) {
+    
+        put_candidate(candidates, "other", json_string_candidate(json_object_get(root, "other")));
+  }
+  if (root_main != NULL) {
+    
+        put_candidate(candidates, "main.double_param", json_double_candidate(json_object_get(root_main, "double")));
+        put_candidate(candidates, "main.first", json_string_candidate(json_object_get(root_main, "first")));
+        put_candidate(candidates, "main.second", json_int_candidate(json_object_get(root_main, "second")));
+        put_candidate(candidates, "main.size", json_size_candidate(json_object_get(root_main, "size")));
+        put_candidate(candidates, "main.third", json_boolean_candidate(json_object_get(root_main, "third")));
+  }
+  if (root_main_deep != NULL) {
+    
+        put_candidate(candidates, "main.deep.param", json_string_candidate(json_object_get(root_main_deep, "param")));
+        put_candidate(candidates, "main.deep.enumtest", json_enum_candidate(json_object_get(root_main_deep, "param_enum")));
+        put_candidate(candidates, "main.deep.params", json_string_candidate(json_object_get(root_main_deep, "params")));
+  }
+
+  json_decref(root);
+  return TRUE;
+}
+
+
+/* Nesting deeper than this is rejected instead of recursing further. */
+#define MP_MAX_DEPTH 64
+
+struct mp_cursor {
+  const guchar *p;
+  const guchar *end;
+};
+
+enum mp_type {
+  MP_NIL,
+  MP_BOOL,
+  MP_INT,
+  MP_UINT,
+  MP_DOUBLE,
+  MP_STR,
+  MP_OTHER
+};
+
+struct mp_value {
+  enum mp_type type;
+  gboolean b;
+  gint64 i;
+  guint64 u;
+  gdouble d;
+  const gchar *str;
+  gsize len;
+};
+
+static gboolean
+mp_take(struct mp_cursor *cur, gsize n, const guchar **data)
+{
+  if ((gsize)(cur->end - cur->p) < n) {
+    return FALSE;
+  }
+
+  *data = cur->p;
+  cur->p += n;
+
+  return TRUE;
+}
+
+static gboolean
+mp_take_uint(struct mp_cursor *cur, gsize n, guint64 *val)
+{
+  const guchar *data;
+
+  if (!mp_take(cur, n, &data)) {
+    return FALSE;
+  }
+
+  *val = 0;
+  for (gsize i = 0; i < n; i++) {
+    *val = (*val << 8) | data[i];
+  }
+
+  return TRUE;
+}
+
+static gboolean mp_read(struct mp_cursor *cur, struct mp_value *val, gint depth);
+
+static gboolean
+mp_skip_items(struct mp_cursor *cur, guint64 count, gint depth)
+{
+  struct mp_value val;
+
+  if (depth >= MP_MAX_DEPTH) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &val, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Reads one value. Strings point into the input buffer, containers, binary
+ * and extension values are skipped by their length prefix and reported as
+ * MP_OTHER. Returns FALSE on truncated or malformed input. */
+static gboolean
+mp_read(struct mp_cursor *cur, struct mp_value *val, gint depth)
+{
+  const guchar *data;
+  guint64 len;
+  guchar t;
+
+  if (!mp_take(cur, 1, &data)) {
+    return FALSE;
+  }
+  t = *data;
+  val->type = MP_OTHER;
+
+  if (t <= 0x7f) {
+    val->type = MP_INT;
+    val->i = t;
+    return TRUE;
+  }
+  if (t >= 0xe0) {
+    val->type = MP_INT;
+    val->i = (gint8) t;
+    return TRUE;
+  }
+  if ((t & 0xe0) == 0xa0) {
+    len = t & 0x1f;
+    goto str;
+  }
+  if ((t & 0xf0) == 0x90) {
+    return mp_skip_items(cur, t & 0x0f, depth);
+  }
+  if ((t & 0xf0) == 0x80) {
+    return mp_skip_items(cur, (t & 0x0f) * 2, depth);
+  }
+
+  switch (t) {
+  case 0xc0:
+    val->type = MP_NIL;
+    return TRUE;
+  case 0xc2:
+  case 0xc3:
+    val->type = MP_BOOL;
+    val->b = t == 0xc3;
+    return TRUE;
+  case 0xcc:
+  case 0xcd:
+  case 0xce:
+  case 0xcf:
+    if (!mp_take_uint(cur, 1 << (t - 0xcc), &val->u)) {
+      return FALSE;
+    }
+    if (val->u > G_MAXINT64) {
+      val->type = MP_UINT;
+    } else {
+      val->type = MP_INT;
+      val->i = (gint64) val->u;
+    }
+    return TRUE;
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+    if (!mp_take_uint(cur, 1 << (t - 0xd0), &val->u)) {
+      return FALSE;
+    }
+    val->type = MP_INT;
+    switch (t) {
+    case 0xd0:
+      val->i = (gint8) val->u;
+      break;
+    case 0xd1:
+      val->i = (gint16) val->u;
+      break;
+    case 0xd2:
+      val->i = (gint32) val->u;
+      break;
+    default:
+      val->i = (gint64) val->u;
+    }
+    return TRUE;
+  case 0xca: {
+    guint32 bits;
+    gfloat f;
+
+    if (!mp_take_uint(cur, 4, &len)) {
+      return FALSE;
+    }
+    bits = (guint32) len;
+    memcpy(&f, &bits, sizeof(f));
+    val->type = MP_DOUBLE;
+    val->d = f;
+    return TRUE;
+  }
+  case 0xcb:
+    if (!mp_take_uint(cur, 8, &val->u)) {
+      return FALSE;
+    }
+    memcpy(&val->d, &val->u, sizeof(val->d));
+    val->type = MP_DOUBLE;
+    return TRUE;
+  case 0xd9:
+  case 0xda:
+  case 0xdb:
+    if (!mp_take_uint(cur, 1 << (t - 0xd9), &len)) {
+      return FALSE;
+    }
+    goto str;
+  case 0xc4:
+  case 0xc5:
+  case 0xc6:
+    if (!mp_take_uint(cur, 1 << (t - 0xc4), &len)) {
+      return FALSE;
+    }
+    return mp_take(cur, len, &data);
+  case 0xd4:
+  case 0xd5:
+  case 0xd6:
+  case 0xd7:
+  case 0xd8:
+    return mp_take(cur, 1 + (1 << (t - 0xd4)), &data);
+  case 0xc7:
+  case 0xc8:
+  case 0xc9:
+    if (!mp_take_uint(cur, 1 << (t - 0xc7), &len)) {
+      return FALSE;
+    }
+    return mp_take(cur, len + 1, &data);
+  case 0xdc:
+  case 0xdd:
+    if (!mp_take_uint(cur, 2 << (t - 0xdc), &len)) {
+      return FALSE;
+    }
+    return mp_skip_items(cur, len, depth);
+  case 0xde:
+  case 0xdf:
+    if (!mp_take_uint(cur, 2 << (t - 0xde), &len)) {
+      return FALSE;
+    }
+    return mp_skip_items(cur, len * 2, depth);
+  default:
+    return FALSE;
+  }
+
+str:
+  if (!mp_take(cur, len, &data)) {
+    return FALSE;
+  }
+  val->type = MP_STR;
+  val->str = (const gchar *) data;
+  val->len = len;
+
+  return TRUE;
+}
+
+/* Reads a map header. Any other value is skipped and treated as an empty
+ * map, the same way json_object_get() ignores non-objects. */
+static gboolean
+mp_read_map(struct mp_cursor *cur, guint64 *count, gint depth)
+{
+  struct mp_value val;
+  guchar t;
+
+  *count = 0;
+
+  if (cur->p >= cur->end) {
+    return FALSE;
+  }
+  t = *cur->p;
+
+  if ((t & 0xf0) == 0x80) {
+    cur->p++;
+    *count = t & 0x0f;
+    return TRUE;
+  }
+  if (t == 0xde || t == 0xdf) {
+    cur->p++;
+    return mp_take_uint(cur, 2 << (t - 0xde), count);
+  }
+
+  return mp_read(cur, &val, depth);
+}
+
+static gboolean
+mp_key_is(const struct mp_value *key, const gchar *name, gsize len)
+{
+  return key->type == MP_STR && key->len == len && memcmp(key->str, name, len) == 0;
+}
+
+static gchar *
+mp_strdup(const struct mp_value *val)
+{
+  if (val->type == MP_STR) {
+    return g_strndup(val->str, val->len);
+  }
+  if (val->type == MP_UINT) {
+    return g_strdup_printf("%" G_GUINT64_FORMAT, val->u);
+  }
+
+  return NULL;
+}
+
+static gboolean
+msgpack_string_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_STR) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected a string");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_enum_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_string_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_int_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_INT) {
+    *c = candidate_new_int(val.i);
+  } else if (val.type == MP_STR || val.type == MP_UINT) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected an integer or a string");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_size_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_int_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_double_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_DOUBLE) {
+    *c = candidate_new_double(val.d);
+  } else if (val.type == MP_INT) {
+    *c = candidate_new_double((gdouble) val.i);
+  } else if (val.type == MP_UINT) {
+    *c = candidate_new_double((gdouble) val.u);
+  } else if (val.type == MP_STR) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected a number or a string");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_boolean_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_BOOL) {
+    *c = candidate_new_string(g_strdup(val.b ? "TRUE" : "FALSE"));
+  } else {
+    *c = candidate_new_invalid("expected a boolean");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_object_root_main_deep(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "param", 5)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.deep.param", c);
+      continue;
+    }
+    if (mp_key_is(&key, "param_enum", 10)) {
+      if (!msgpack_enum_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.deep.enumtest", c);
+      continue;
+    }
+    if (mp_key_is(&key, "params", 6)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.deep.params", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_object_root_main(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "deep", 4)) {
+      if (!msgpack_object_root_main_deep(candidates, cur, depth + 1)) {
+        return FALSE;
+      }
+      continue;
+    }
+    if (mp_key_is(&key, "double", 6)) {
+      if (!msgpack_double_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.double_param", c);
+      continue;
+    }
+    if (mp_key_is(&key, "first", 5)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.first", c);
+      continue;
+    }
+    if (mp_key_is(&key, "second", 6)) {
+      if (!msgpack_int_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.second", c);
+      continue;
+    }
+    if (mp_key_is(&key, "size", 4)) {
+      if (!msgpack_size_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.size", c);
+      continue;
+    }
+    if (mp_key_is(&key, "third", 5)) {
+      if (!msgpack_boolean_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "main.third", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_object_root(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "main", 4)) {
+      if (!msgpack_object_root_main(candidates, cur, depth + 1)) {
+        return FALSE;
+      }
+      continue;
+    }
+    if (mp_key_is(&key, "other", 5)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "other", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+parse_msgpack_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  GMappedFile *map = NULL;
+  struct mp_cursor cur;
+  GError *local_err = NULL;
+  gboolean ok;
+
+  g_assert(candidates);
+  g_assert(file);
+
+  map = g_mapped_file_new(file, FALSE, &local_err);
+  if (map == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: %s",
+                file,
+                local_err->message);
+    g_clear_error(&local_err);
+    return FALSE;
+  }
+
+  cur.p = (const guchar *) g_mapped_file_get_contents(map);
+  cur.end = cur.p + g_mapped_file_get_length(map);
+
+  /* Like json_load_file, reject anything after the root value. */
+  ok = msgpack_object_root(candidates, &cur, 0) && cur.p == cur.end;
+  g_mapped_file_unref(map);
+
+  if (!ok) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: malformed msgpack",
+                file);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/* Only merges into candidates once the whole file has been decoded. */
+static gboolean
+parse_config_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  GHashTable *parsed = NULL;
+  GHashTableIter iter;
+  gpointer name;
+  gpointer c;
+  gboolean ok;
+
+  parsed = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  if (g_str_has_suffix(file, ".msgpack")) {
+    ok = parse_msgpack_file(parsed, file, err);
+  } else {
+    ok = parse_json_file(parsed, file, err);
+  }
+
+  if (ok) {
+    g_hash_table_iter_init(&iter, parsed);
+    while (g_hash_table_iter_next(&iter, &name, &c)) {
+      g_hash_table_iter_steal(&iter);
+      (void) g_hash_table_replace(candidates, name, c);
+    }
+  }
+  g_hash_table_unref(parsed);
+
+  return ok;
+}
+
+static gboolean
+parse_config(GHashTable *candidates, GError **err)
+{
+  gchar *file = NULL;
+  gboolean ok;
+
+  file = get_config_file();
+  ok = parse_config_file(candidates, file, err);
+  g_free(file);
+
+  return ok;
+}
+
+/* Every setter starts with this, so that a value of the wrong type is
+ * reported rather than replaced by the default. */
+static gboolean
+check_candidate(const gchar *name, const struct candidate *c, GError **err)
+{
+  if (c != NULL && c->type == CANDIDATE_INVALID) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid value: %s",
+                name, c->str);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+check_string(const gchar *name, const struct candidate *c, gint64 min, gint64 max, gint options, const gchar* opts[], GError **err)
+{
+  const gchar *str;
+
+  g_assert(name);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL || c->str == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+  str = c->str;
+
+  if (strlen(str) < min) {
+    g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_SMALL,
+                  "Parameter %s too short (min %ld chars)",
+                  name, min);
+    return FALSE;
+  }
+
+  if (strlen(str) > max) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_BIG,
+                  "Parameter %s too long (max %ld chars)",
+                  name, max);
+    return FALSE;
+  }
+
+  if (options > 0) {
+    gboolean ok = FALSE;
+    for (gint i = 0; i < options; i++) {
+        if (g_strcmp0(opts[i], str) == 0) {
+            ok = TRUE;
+            break;
+        }
+    }
+    if (!ok) {
+      g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+set_string(const gchar *name, const struct candidate *c, gchar **dst, gint64 min, gint64 max, gint options, const gchar* opts[], GError **err)
+{
+  g_assert(dst);
+
+  if (!check_string(name, c, min, max, options, opts, err)) {
+    return FALSE;
+  }
+
+  *dst = g_strdup(c->str);
+
+  return TRUE;
+}
+
+static gboolean
+set_int(const gchar *name, const struct candidate *c, gint64 *dst, gint64 min, gint64 max, gint options, const gint64 *opts, GError **err)
+{
+  const gchar *str;
+  gint64 tmp;
+  gchar *endp;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+
+  if (c->type == CANDIDATE_INT) {
+    tmp = c->i;
+    goto validate;
+  }
+  str = c->str;
+
+  tmp = g_ascii_strtoll(str, &endp, 10);
+
+  if (tmp == 0 && endp == str) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid value",
+                name);
+    return FALSE;
+  }
+
+  if (tmp == G_MAXINT64 && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_BIG,
+                "Parameter %s too big (max %ld)",
+                name, max);
+    return FALSE;
+  }
+
+  if (tmp == G_MININT64 && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %ld)",
+                name, min);
+    return FALSE;
+  }
+
+validate:
+  if (tmp < min) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %ld)",
+                 name, min);
+    return FALSE;
+  }
+
+  if (tmp > max) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_BIG,
+                  "Parameter %s too big (max %ld)",
+                  name, max);
+    return FALSE;
+  }
+
+  if (options > 0) {
+    gboolean ok = FALSE;
+    for (gint i = 0; i < options; i++) {
+        if (opts[i] == tmp) {
+            ok = TRUE;
+            break;
+        }
+    }
+    if (!ok) {
+      g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+      return FALSE;
+    }
+  }
+
+  *dst = tmp;
+
+  return TRUE;
+}
+
+static gboolean
+set_size(const gchar *name, const struct candidate *c, gint64 *dst, gint64 min, gint64 max, gint options, const gint64 *opts, GError **err)
+{
+  const gchar *str;
+  gint64 tmp;
+  gchar *endp;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+
+  if (c->type == CANDIDATE_INT) {
+    tmp = c->i;
+    goto validate;
+  }
+  str = c->str;
+
+  tmp = g_ascii_strtoll(str, &endp, 10);
+
+  if (tmp == 0 && endp == str) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid value",
+                name);
+    return FALSE;
+  }
+
+  if (tmp == G_MAXINT64 && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_BIG,
+                "Parameter %s too big (max %ld)",
+                name, max);
+    return FALSE;
+  }
+
+  if (tmp == G_MININT64 && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %ld)",
+                name, min);
+    return FALSE;
+  }
+
+  if (g_str_has_suffix(str, "kb") || g_str_has_suffix(str, "KB") ) {
+    tmp = tmp * 1024;
+  }
+
+  if (g_str_has_suffix(str, "mb") || g_str_has_suffix(str, "MB") ) {
+    tmp = tmp * 1024 * 1024;
+  }
+
+  if (g_str_has_suffix(str, "gb") || g_str_has_suffix(str, "GB") ) {
+    tmp = tmp * 1024 * 1024 * 1024;
+  }
+
+validate:
+  if (tmp < min) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %ld)",
+                 name, min);
+    return FALSE;
+  }
+
+  if (tmp > max) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_BIG,
+                  "Parameter %s too big (max %ld)",
+                  name, max);
+    return FALSE;
+  }
+
+  if (options > 0) {
+    gboolean ok = FALSE;
+    for (gint i = 0; i < options; i++) {
+        if (opts[i] == tmp) {
+            ok = TRUE;
+            break;
+        }
+    }
+    if (!ok) {
+      g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+      return FALSE;
+    }
+  }
+
+  *dst = tmp;
+
+  return TRUE;
+}
+
+static gboolean
+set_double(const gchar *name, const struct candidate *c, gdouble *dst, gdouble min, gdouble max, gint options, const gdouble *opts, GError **err)
+{
+  const gchar *str;
+  gdouble tmp;
+  gchar *endp;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+
+  if (c->type == CANDIDATE_DOUBLE) {
+    tmp = c->d;
+    goto validate;
+  }
+  if (c->type == CANDIDATE_INT) {
+    tmp = (gdouble) c->i;
+    goto validate;
+  }
+  str = c->str;
+
+  tmp = g_ascii_strtod(str, &endp);
+
+  if (tmp == 0.0 && endp == str) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid value",
+                name);
+    return FALSE;
+  }
+
+  if (tmp == HUGE_VAL && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_BIG,
+                "Parameter %s too big (max %lf)",
+                name, max);
+    return FALSE;
+  }
+
+  if (tmp == 0 && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %lf)",
+                name, min);
+    return FALSE;
+  }
+
+validate:
+  if (tmp < min) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %lf)",
+                 name, min);
+    return FALSE;
+  }
+
+  if (tmp > max) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_BIG,
+                  "Parameter %s too big (max %lf)",
+                  name, max);
+    return FALSE;
+  }
+
+  if (options > 0) {
+    gboolean ok = FALSE;
+    for (gint i = 0; i < options; i++) {
+        if (opts[i] == tmp) {
+            ok = TRUE;
+            break;
+        }
+    }
+    if (!ok) {
+      g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+      return FALSE;
+    }
+  }
+
+  *dst = tmp;
+
+  return TRUE;
+}
+
+static gboolean
+set_boolean(const gchar *name, const struct candidate *c, gboolean *dst, GError **err)
+{
+  const gchar *str;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL || c->str == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+  str = c->str;
+
+  if (g_strcmp0(str, "TRUE") == 0) {
+    *dst = TRUE;
+    return TRUE;
+  }
+  if (g_strcmp0(str, "FALSE") == 0) {
+    *dst = FALSE;
+    return TRUE;
+  }
+
+  g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+
+  return FALSE;
+}
+
+
+static gboolean
+set_enum_main_deep_enumtest(const gchar *name, const struct candidate *c, enum config_main_deep_enumtest *dst, GError **err)
+{
+  const gchar *str;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL || c->str == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+  str = c->str;
+  if (g_strcmp0(str, "hello") == 0) {
+    *dst = MAIN_DEEP_ENUMTEST_HELLO;
+    return TRUE;
+  }
+  if (g_strcmp0(str, "goodbye") == 0) {
+    *dst = MAIN_DEEP_ENUMTEST_GOODBYE;
+    return TRUE;
+  }
+
+  g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+
+  return FALSE;
+}
+
+
+
+
+static gboolean
+check_and_set(struct config_core *cfg, GHashTable *candidates, GError **err)
+{
+    const gchar *valid_main_deep_param[] = { "hello", "goodbye"};
+
+  g_assert(cfg);
+  g_assert(candidates);
+  g_assert(err != NULL && *err == NULL);
+    if (!set_string("main.first", g_hash_table_lookup(candidates, "main.first"), &cfg->main.first, 1, 10, 0, NULL, err)) {
+        return FALSE;
+    }
+    if (!set_int("main.second", g_hash_table_lookup(candidates, "main.second"), &cfg->main.second, 1, 10, 0, NULL, err)) {
+        return FALSE;
+    }
+    if (!set_boolean("main.third", g_hash_table_lookup(candidates, "main.third"), &cfg->main.third, err)) {
+        return FALSE;
+    }
+    if (!set_double("main.double_param", g_hash_table_lookup(candidates, "main.double_param"), &cfg->main.double_param, -10, 100, 0, NULL, err)) {
+        return FALSE;
+    }
+    if (!set_size("main.size", g_hash_table_lookup(candidates, "main.size"), &cfg->main.size, 0, 10000000, 0, NULL, err)) {
+        return FALSE;
+    }
+    if (!set_string("main.deep.param", g_hash_table_lookup(candidates, "main.deep.param"), &cfg->main.deep.param, 1, 24, 2, valid_main_deep_param, err)) {
+        return FALSE;
+    }
+    if (!set_enum_main_deep_enumtest("main.deep.enumtest", g_hash_table_lookup(candidates, "main.deep.enumtest"), &cfg->main.deep.enumtest, err)) {
+        return FALSE;
+    }
+    if (!set_string("main.deep.params", g_hash_table_lookup(candidates, "main.deep.params"), &cfg->main.deep.params, 1, 24, 0, NULL, err)) {
+        return FALSE;
+    }
+    if (!set_string("other", g_hash_table_lookup(candidates, "other"), &cfg->other, 1, 24, 0, NULL, err)) {
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+check_all(struct config_core *cfg, GHashTable *candidates, config_error_func func, gpointer user_data)
+{
+    const gchar *valid_main_deep_param[] = { "hello", "goodbye"};
+  GError *local_err = NULL;
+  GError **err = &local_err;
+  gboolean ok = TRUE;
+
+  g_assert(cfg);
+  g_assert(candidates);
+  g_assert(func);
+    if (!set_string("main.first", g_hash_table_lookup(candidates, "main.first"), &cfg->main.first, 1, 10, 0, NULL, err)) {
+        func("main.first", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_int("main.second", g_hash_table_lookup(candidates, "main.second"), &cfg->main.second, 1, 10, 0, NULL, err)) {
+        func("main.second", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_boolean("main.third", g_hash_table_lookup(candidates, "main.third"), &cfg->main.third, err)) {
+        func("main.third", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_double("main.double_param", g_hash_table_lookup(candidates, "main.double_param"), &cfg->main.double_param, -10, 100, 0, NULL, err)) {
+        func("main.double", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_size("main.size", g_hash_table_lookup(candidates, "main.size"), &cfg->main.size, 0, 10000000, 0, NULL, err)) {
+        func("main.size", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_string("main.deep.param", g_hash_table_lookup(candidates, "main.deep.param"), &cfg->main.deep.param, 1, 24, 2, valid_main_deep_param, err)) {
+        func("main.deep.param", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_enum_main_deep_enumtest("main.deep.enumtest", g_hash_table_lookup(candidates, "main.deep.enumtest"), &cfg->main.deep.enumtest, err)) {
+        func("main.deep.param_enum", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_string("main.deep.params", g_hash_table_lookup(candidates, "main.deep.params"), &cfg->main.deep.params, 1, 24, 0, NULL, err)) {
+        func("main.deep.params", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_string("other", g_hash_table_lookup(candidates, "other"), &cfg->other, 1, 24, 0, NULL, err)) {
+        func("other", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+
+  return ok;
+}
+
+gboolean
+config_core_check_and_set(struct config_core *cfg, GHashTable *candidates, GError **err)
+{
+  return check_and_set(cfg, candidates, err);
+}
+
+gboolean
+config_core_check_all(struct config_core *cfg, GHashTable *candidates, config_error_func func, gpointer user_data)
+{
+  return check_all(cfg, candidates, func, user_data);
+}
+
+/* Reads the sources that take precedence over the config file. Both come
+ * from process state, so this always runs on the calling thread. */
+static gboolean
+parse_overrides(GHashTable *overrides, gint *argc, gchar **argv[], GError **err)
+{
+  g_assert(overrides);
+
+  set_env(overrides);
+
+  if (!parse_opts(overrides, argc, argv, err)) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Reads the defaults and the config file, applies overrides on top and
+ * validates the result into cfg. Overrides are moved, not copied. */
+static gboolean
+parse_sources(struct config_core *cfg, GHashTable *overrides, gboolean die_on_json_error, GError **err)
+{
+  GHashTable * candidates = NULL;
+  GHashTableIter iter;
+  gpointer name;
+  gpointer c;
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+
+
+  if (die_on_json_error) {
+    if (!parse_config(candidates, err)) {
+        goto err;
+    }
+  } else {
+    (void)parse_config(candidates, NULL);
+  }
+
+  g_hash_table_iter_init(&iter, overrides);
+  while (g_hash_table_iter_next(&iter, &name, &c)) {
+    g_hash_table_iter_steal(&iter);
+    (void) g_hash_table_replace(candidates, name, c);
+  }
+
+  if (!check_and_set(cfg, candidates, err)) {
+    goto err;
+  }
+  g_hash_table_remove_all(candidates);
+  g_clear_pointer(&candidates, g_hash_table_unref);
+
+  return TRUE;
+
+err:
+  g_hash_table_remove_all(candidates);
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_core_clear(cfg);
+
+  return FALSE;
+}
+
+gboolean
+config_core_parse(struct config_core *cfg, gint argc, gchar *argv[], gboolean die_on_json_error, GError **err) {
+  GHashTable *overrides = NULL;
+  gboolean ok = FALSE;
+
+  overrides = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  if (parse_overrides(overrides, &argc, &argv, err)) {
+    ok = parse_sources(cfg, overrides, die_on_json_error, err);
+  }
+  g_clear_pointer(&overrides, g_hash_table_unref);
+
+  return ok;
+}
+
+struct parse_task {
+  GHashTable *overrides;
+  gboolean die_on_json_error;
+  struct config_core cfg;
+};
+
+static void
+parse_task_free(gpointer data)
+{
+  struct parse_task *t = data;
+
+  g_clear_pointer(&t->overrides, g_hash_table_unref);
+  config_core_clear(&t->cfg);
+  g_free(t);
+}
+
+static void
+parse_thread(GTask *task, gpointer source, gpointer data, GCancellable *cancellable)
+{
+  struct parse_task *t = data;
+  GError *err = NULL;
+
+  if (g_task_return_error_if_cancelled(task)) {
+    return;
+  }
+
+  if (!parse_sources(&t->cfg, t->overrides, t->die_on_json_error, &err)) {
+    g_task_return_error(task, err);
+    return;
+  }
+
+  g_task_return_boolean(task, TRUE);
+}
+
+void
+config_core_parse_async(gint argc, gchar *argv[], gboolean die_on_json_error, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+  struct parse_task *t = NULL;
+  GTask *task = NULL;
+  GError *err = NULL;
+
+  task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, config_core_parse_async);
+
+  t = g_new0(struct parse_task, 1);
+  t->overrides = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+  t->die_on_json_error = die_on_json_error;
+  g_task_set_task_data(task, t, parse_task_free);
+
+  if (!parse_overrides(t->overrides, &argc, &argv, &err)) {
+    g_task_return_error(task, err);
+  } else {
+    g_task_run_in_thread(task, parse_thread);
+  }
+
+  g_object_unref(task);
+}
+
+gboolean
+config_core_parse_finish(struct config_core *cfg, GAsyncResult *result, GError **err)
+{
+  struct parse_task *t = NULL;
+
+  g_assert(cfg);
+  g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+
+  if (!g_task_propagate_boolean(G_TASK(result), err)) {
+    return FALSE;
+  }
+
+  t = g_task_get_task_data(G_TASK(result));
+  *cfg = t->cfg;
+  memset(&t->cfg, 0, sizeof(t->cfg));
+
+  return TRUE;
+}
+
+gboolean
+config_core_check_file(const gchar *file, config_error_func func, gpointer user_data)
+{
+  struct config_core cfg = {};
+  GHashTable *candidates = NULL;
+  GError *err = NULL;
+  gboolean ok = FALSE;
+
+  g_assert(file);
+  g_assert(func);
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+  if (!parse_config_file(candidates, file, &err)) {
+    func("", err, user_data);
+    g_clear_error(&err);
+    goto out;
+  }
+
+  ok = check_all(&cfg, candidates, func, user_data);
+
+out:
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_core_clear(&cfg);
+
+  return ok;
+}
+
+gboolean
+config_core_parse_file(struct config_core *cfg, const gchar *file, GError **err)
+{
+  GHashTable *candidates = NULL;
+
+  g_assert(cfg);
+  g_assert(file);
+  g_assert(err != NULL && *err == NULL);
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+  if (!parse_config_file(candidates, file, err)) {
+    goto err;
+  }
+
+  if (!check_and_set(cfg, candidates, err)) {
+    goto err;
+  }
+  g_clear_pointer(&candidates, g_hash_table_unref);
+
+  return TRUE;
+
+err:
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_core_clear(cfg);
+
+  return FALSE;
+}
+
+
+const gchar *
+config_name_enum_main_deep_enumtest(enum config_main_deep_enumtest val)
+{
+    switch (val) {
+    case MAIN_DEEP_ENUMTEST_HELLO:
+      return "hello";
+    case MAIN_DEEP_ENUMTEST_GOODBYE:
+      return "goodbye";
+    default:
+      g_assert_not_reached();
+    }
+
+    return "";
+}
+
+
+
+
+
+
+void
+config_core_clear(struct config_core *cfg)
+{
+  g_clear_pointer(&cfg->main.first, g_free);
+  g_clear_pointer(&cfg->main.deep.param, g_free);
+  g_clear_pointer(&cfg->main.deep.params, g_free);
+  g_clear_pointer(&cfg->other, g_free);
+  memset(cfg, 0, sizeof(*cfg));
+}
+
+gchar *
+config_core_to_string(struct config_core *cfg)
+{
+  return g_strdup_printf("main.first: %s\n"
+"main.second: %ld\n"
+"main.third: %d\n"
+"main.double_param: %lf\n"
+"main.size: %ld\n"
+"main.deep.param: %s\n"
+"main.deep.enumtest: %s\n"
+"main.deep.params: %s\n"
+"other: %s\n"
+,
+  cfg->main.first,
+  cfg->main.second,
+  cfg->main.third,
+  cfg->main.double_param,
+  cfg->main.size,
+  cfg->main.deep.param,
+  config_name_enum_main_deep_enumtest(cfg->main.deep.enumtest),
+  cfg->main.deep.params,
+  cfg->other);
+}
\ No newline at end of file
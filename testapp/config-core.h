@@ -0,0 +1,83 @@
+
+#ifndef _CONFIG_CORE_H_
+#define _CONFIG_CORE_H_
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "config-common.h"
+
+
+enum config_main_deep_enumtest {
+    MAIN_DEEP_ENUMTEST_HELLO,
+    MAIN_DEEP_ENUMTEST_GOODBYE,
+};
+
+
+
+
+
+struct config_core_main_deep {
+    enum config_main_deep_enumtest enumtest; /**  */
+    gchar *param; /**  */
+    gchar *params; /**  */
+};
+
+struct config_core_main {
+    struct config_core_main_deep deep; /**  */
+    gdouble double_param; /**  */
+    gchar *first; /** This is a variable */
+    gint64 second; /**  */
+    gint64 size; /**  */
+    gboolean third; /**  */
+};
+
+struct config_core {
+    struct config_core_main main; /**  */
+    gchar *other; /**  */
+};
+
+
+gboolean
+config_core_parse(struct config_core *cfg, gint argc, gchar *argv[], gboolean die_on_json_error, GError **err);
+
+/* Runs config_core_parse on a worker thread. The environment and command line
+ * are read before returning, file I/O and validation happen on the thread.
+ * callback is invoked in the thread-default main context of the caller. */
+void
+config_core_parse_async(gint argc, gchar *argv[], gboolean die_on_json_error, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+/* Moves the parsed config into cfg, which is left untouched on error. */
+gboolean
+config_core_parse_finish(struct config_core *cfg, GAsyncResult *result, GError **err);
+
+/* Validates the candidates read by the composed config.c into cfg. */
+gboolean
+config_core_check_and_set(struct config_core *cfg, GHashTable *candidates, GError **err);
+
+gboolean
+config_core_check_all(struct config_core *cfg, GHashTable *candidates, config_error_func func, gpointer user_data);
+
+void
+config_core_clear(struct config_core *cfg);
+
+gboolean
+config_core_check_file(const gchar *file, config_error_func func, gpointer user_data);
+
+/* Like config_core_parse but only reads the defaults and the given json or
+ * msgpack file, ignoring the environment and command line. */
+gboolean
+config_core_parse_file(struct config_core *cfg, const gchar *file, GError **err);
+
+gchar *
+config_core_to_string(struct config_core *cfg);
+
+
+
+
+const gchar *
+config_name_enum_main_deep_enumtest(enum config_main_deep_enumtest val);
+
+#endif /* _CONFIG_CORE_H_ */
+
+
@@ -0,0 +1,2220 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <jansson.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "config-network.h"
+
+/* Numbers read from json or msgpack are kept in their native type so they
+ * do not take a trip through a string before being validated. A value of
+ * the wrong type is kept as invalid, with the reason in str, so that it is
+ * reported instead of falling back to the default. */
+enum candidate_type {
+  CANDIDATE_STRING,
+  CANDIDATE_INT,
+  CANDIDATE_DOUBLE,
+  CANDIDATE_MAP,
+  CANDIDATE_INVALID
+};
+
+struct candidate {
+  enum candidate_type type;
+  gchar *str;
+  gint64 i;
+  gdouble d;
+  gchar **strv;
+  GPtrArray *entries;
+};
+
+/* One entry of a map candidate, fields are indexed in schema order. An
+ * entry that is not an object is kept as invalid so that it is reported. */
+struct candidate_entry {
+  gchar *key;
+  gboolean invalid;
+  guint n_fields;
+  struct candidate **fields;
+};
+
+static void
+candidate_free(gpointer data)
+{
+  struct candidate *c = data;
+
+  if (c == NULL) {
+    return;
+  }
+
+  g_free(c->str);
+  g_strfreev(c->strv);
+  if (c->entries != NULL) {
+    g_ptr_array_unref(c->entries);
+  }
+  g_free(c);
+}
+
+static void
+candidate_entry_free(gpointer data)
+{
+  struct candidate_entry *e = data;
+
+  for (guint i = 0; i < e->n_fields; i++) {
+    candidate_free(e->fields[i]);
+  }
+  g_free(e->fields);
+  g_free(e->key);
+  g_free(e);
+}
+
+static struct candidate *
+candidate_new_string(gchar *value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_STRING;
+  c->str = value;
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_int(gint64 value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_INT;
+  c->i = value;
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_strv(gchar **value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_STRING;
+  c->strv = value;
+
+  return c;
+}
+
+static struct candidate * G_GNUC_PRINTF(1, 2)
+candidate_new_invalid(const gchar *format, ...)
+{
+  struct candidate *c = NULL;
+  va_list args;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_INVALID;
+  va_start(args, format);
+  c->str = g_strdup_vprintf(format, args);
+  va_end(args);
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_map(guint reserve)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_MAP;
+  c->entries = g_ptr_array_new_full(reserve, candidate_entry_free);
+
+  return c;
+}
+
+static struct candidate_entry *
+candidate_entry_new(gchar *key, guint n_fields)
+{
+  struct candidate_entry *e = NULL;
+
+  e = g_new0(struct candidate_entry, 1);
+  e->key = key;
+  e->n_fields = n_fields;
+  e->fields = g_new0(struct candidate *, n_fields);
+
+  return e;
+}
+
+static void
+put_candidate(GHashTable *candidates, gchar *name, struct candidate *c)
+{
+  g_assert(candidates);
+  g_assert(name);
+
+  if (c == NULL) {
+    return;
+  }
+
+  (void) g_hash_table_replace(candidates, (gpointer)name, (gpointer)c);
+}
+
+static void
+set_candidate(GHashTable *candidates, gchar *name, gchar *value)
+{
+  if (value == NULL) {
+    return;
+  }
+
+  put_candidate(candidates, name, candidate_new_string(value));
+}
+
+
+
+
+static gboolean
+set_defaults(GHashTable *candidates)
+{
+  g_assert(candidates);
+  set_candidate(candidates, "allow.paths", g_strdup("/static/*"));
+  set_candidate(candidates, "resolver.hosts", g_strdup("/etc/hosts"));
+
+  return TRUE;
+}
+
+static gchar *
+get_config_file()
+{
+  if (g_file_test("./config.msgpack", G_FILE_TEST_IS_REGULAR)) {
+    return g_strdup("./config.msgpack");
+  }
+  return g_strdup("./config.json");
+}
+
+static struct candidate *
+json_string_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
+  }
+
+  return candidate_new_invalid("expected a string");
+}
+
+static struct candidate *
+json_int_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
+  }
+  if (json_is_integer(val)) {
+    return candidate_new_int(json_integer_value(val));
+  }
+
+  return candidate_new_invalid("expected an integer or a string");
+}
+
+static struct candidate *
+json_enum_candidate(json_t *val)
+{
+  return json_string_candidate(val);
+}
+
+/* A pattern is either a single string or an array of strings that are
+ * matched as one. */
+static struct candidate *
+json_regex_candidate(json_t *val)
+{
+  GPtrArray *patterns = NULL;
+  json_t *pattern;
+  gsize i;
+
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
+  }
+  if (!json_is_array(val)) {
+    return candidate_new_invalid("expected a string or an array of strings");
+  }
+
+  patterns = g_ptr_array_sized_new(json_array_size(val) + 1);
+  json_array_foreach(val, i, pattern) {
+    if (!json_is_string(pattern)) {
+      g_ptr_array_set_free_func(patterns, g_free);
+      g_ptr_array_unref(patterns);
+      return candidate_new_invalid("element %u is not a string", (guint) i);
+    }
+    g_ptr_array_add(patterns, g_strdup(json_string_value(pattern)));
+  }
+  g_ptr_array_add(patterns, NULL);
+
+  return candidate_new_strv((gchar **) g_ptr_array_free(patterns, FALSE));
+}
+
+static struct candidate *
+json_glob_candidate(json_t *val)
+{
+  return json_regex_candidate(val);
+}
+
+static struct candidate *
+json_file_candidate(json_t *val)
+{
+  return json_string_candidate(val);
+}
+
+static struct candidate *
+json_map_routes_candidate(json_t *val)
+{
+  struct candidate *c = NULL;
+  struct candidate_entry *e = NULL;
+  const gchar *key;
+  json_t *obj;
+
+  if (val == NULL) {
+    return NULL;
+  }
+  if (!json_is_object(val)) {
+    return candidate_new_invalid("expected an object");
+  }
+
+  c = candidate_new_map(json_object_size(val));
+  json_object_foreach(val, key, obj) {
+    e = candidate_entry_new(g_strdup(key), 3);
+    if (!json_is_object(obj)) {
+      e->invalid = TRUE;
+      g_ptr_array_add(c->entries, e);
+      continue;
+    }
+    e->fields[0] = json_string_candidate(json_object_get(obj, "backend"));
+    e->fields[1] = json_int_candidate(json_object_get(obj, "weight"));
+    e->fields[2] = json_enum_candidate(json_object_get(obj, "mode"));
+    g_ptr_array_add(c->entries, e);
+  }
+
+  return c;
+}
+
+
+static void
+json_init(void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized)) {
+    json_set_alloc_funcs(g_malloc, g_free);
+    g_once_init_leave(&initialized, 1);
+  }
+}
+
+static gboolean
+parse_json_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  json_error_t j_error;
+  json_t *root = NULL;
+  json_t *root_allow = NULL;
+  json_t *root_resolver = NULL;
+
+  g_assert(candidates);
+  g_assert(file);
+
+  json_init();
+  root = json_load_file(file, 0, &j_error);
+
+  if (root == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: %s",
+                file,
+                j_error.text);
+    return FALSE;
+  }
+  if (root != NULL) {
+    root_allow = json_object_get(root, "allow");
+  }
+  if (root != NULL) {
+    root_resolver = json_object_get(root, "resolver");
+  }
+  if (root != NULL) {
+    
+        put_candidate(candidates, "routes", json_map_routes_candidate(json_object_get(root, "routes")));
+  }
+  if (root_allow != NULL) {
+    
+        put_candidate(candidates, "allow.paths", json_glob_candidate(json_object_get(root_allow, "paths")));
+  }
+  if (root_resolver != NULL) {
+    
+        put_candidate(candidates, "resolver.hosts", json_file_candidate(json_object_get(root_resolver, "hosts")));
+  }
+
+  json_decref(root);
+  return TRUE;
+}
+
+
+/* Nesting deeper than this is rejected instead of recursing further. */
+#define MP_MAX_DEPTH 64
+
+struct mp_cursor {
+  const guchar *p;
+  const guchar *end;
+};
+
+enum mp_type {
+  MP_NIL,
+  MP_BOOL,
+  MP_INT,
+  MP_UINT,
+  MP_DOUBLE,
+  MP_STR,
+  MP_OTHER
+};
+
+struct mp_value {
+  enum mp_type type;
+  gboolean b;
+  gint64 i;
+  guint64 u;
+  gdouble d;
+  const gchar *str;
+  gsize len;
+};
+
+static gboolean
+mp_take(struct mp_cursor *cur, gsize n, const guchar **data)
+{
+  if ((gsize)(cur->end - cur->p) < n) {
+    return FALSE;
+  }
+
+  *data = cur->p;
+  cur->p += n;
+
+  return TRUE;
+}
+
+static gboolean
+mp_take_uint(struct mp_cursor *cur, gsize n, guint64 *val)
+{
+  const guchar *data;
+
+  if (!mp_take(cur, n, &data)) {
+    return FALSE;
+  }
+
+  *val = 0;
+  for (gsize i = 0; i < n; i++) {
+    *val = (*val << 8) | data[i];
+  }
+
+  return TRUE;
+}
+
+static gboolean mp_read(struct mp_cursor *cur, struct mp_value *val, gint depth);
+
+static gboolean
+mp_skip_items(struct mp_cursor *cur, guint64 count, gint depth)
+{
+  struct mp_value val;
+
+  if (depth >= MP_MAX_DEPTH) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &val, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Reads one value. Strings point into the input buffer, containers, binary
+ * and extension values are skipped by their length prefix and reported as
+ * MP_OTHER. Returns FALSE on truncated or malformed input. */
+static gboolean
+mp_read(struct mp_cursor *cur, struct mp_value *val, gint depth)
+{
+  const guchar *data;
+  guint64 len;
+  guchar t;
+
+  if (!mp_take(cur, 1, &data)) {
+    return FALSE;
+  }
+  t = *data;
+  val->type = MP_OTHER;
+
+  if (t <= 0x7f) {
+    val->type = MP_INT;
+    val->i = t;
+    return TRUE;
+  }
+  if (t >= 0xe0) {
+    val->type = MP_INT;
+    val->i = (gint8) t;
+    return TRUE;
+  }
+  if ((t & 0xe0) == 0xa0) {
+    len = t & 0x1f;
+    goto str;
+  }
+  if ((t & 0xf0) == 0x90) {
+    return mp_skip_items(cur, t & 0x0f, depth);
+  }
+  if ((t & 0xf0) == 0x80) {
+    return mp_skip_items(cur, (t & 0x0f) * 2, depth);
+  }
+
+  switch (t) {
+  case 0xc0:
+    val->type = MP_NIL;
+    return TRUE;
+  case 0xc2:
+  case 0xc3:
+    val->type = MP_BOOL;
+    val->b = t == 0xc3;
+    return TRUE;
+  case 0xcc:
+  case 0xcd:
+  case 0xce:
+  case 0xcf:
+    if (!mp_take_uint(cur, 1 << (t - 0xcc), &val->u)) {
+      return FALSE;
+    }
+    if (val->u > G_MAXINT64) {
+      val->type = MP_UINT;
+    } else {
+      val->type = MP_INT;
+      val->i = (gint64) val->u;
+    }
+    return TRUE;
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+    if (!mp_take_uint(cur, 1 << (t - 0xd0), &val->u)) {
+      return FALSE;
+    }
+    val->type = MP_INT;
+    switch (t) {
+    case 0xd0:
+      val->i = (gint8) val->u;
+      break;
+    case 0xd1:
+      val->i = (gint16) val->u;
+      break;
+    case 0xd2:
+      val->i = (gint32) val->u;
+      break;
+    default:
+      val->i = (gint64) val->u;
+    }
+    return TRUE;
+  case 0xca: {
+    guint32 bits;
+    gfloat f;
+
+    if (!mp_take_uint(cur, 4, &len)) {
+      return FALSE;
+    }
+    bits = (guint32) len;
+    memcpy(&f, &bits, sizeof(f));
+    val->type = MP_DOUBLE;
+    val->d = f;
+    return TRUE;
+  }
+  case 0xcb:
+    if (!mp_take_uint(cur, 8, &val->u)) {
+      return FALSE;
+    }
+    memcpy(&val->d, &val->u, sizeof(val->d));
+    val->type = MP_DOUBLE;
+    return TRUE;
+  case 0xd9:
+  case 0xda:
+  case 0xdb:
+    if (!mp_take_uint(cur, 1 << (t - 0xd9), &len)) {
+      return FALSE;
+    }
+    goto str;
+  case 0xc4:
+  case 0xc5:
+  case 0xc6:
+    if (!mp_take_uint(cur, 1 << (t - 0xc4), &len)) {
+      return FALSE;
+    }
+    return mp_take(cur, len, &data);
+  case 0xd4:
+  case 0xd5:
+  case 0xd6:
+  case 0xd7:
+  case 0xd8:
+    return mp_take(cur, 1 + (1 << (t - 0xd4)), &data);
+  case 0xc7:
+  case 0xc8:
+  case 0xc9:
+    if (!mp_take_uint(cur, 1 << (t - 0xc7), &len)) {
+      return FALSE;
+    }
+    return mp_take(cur, len + 1, &data);
+  case 0xdc:
+  case 0xdd:
+    if (!mp_take_uint(cur, 2 << (t - 0xdc), &len)) {
+      return FALSE;
+    }
+    return mp_skip_items(cur, len, depth);
+  case 0xde:
+  case 0xdf:
+    if (!mp_take_uint(cur, 2 << (t - 0xde), &len)) {
+      return FALSE;
+    }
+    return mp_skip_items(cur, len * 2, depth);
+  default:
+    return FALSE;
+  }
+
+str:
+  if (!mp_take(cur, len, &data)) {
+    return FALSE;
+  }
+  val->type = MP_STR;
+  val->str = (const gchar *) data;
+  val->len = len;
+
+  return TRUE;
+}
+
+/* Reads a map header. Any other value is skipped and treated as an empty
+ * map, the same way json_object_get() ignores non-objects. */
+static gboolean
+mp_read_map(struct mp_cursor *cur, guint64 *count, gint depth)
+{
+  struct mp_value val;
+  guchar t;
+
+  *count = 0;
+
+  if (cur->p >= cur->end) {
+    return FALSE;
+  }
+  t = *cur->p;
+
+  if ((t & 0xf0) == 0x80) {
+    cur->p++;
+    *count = t & 0x0f;
+    return TRUE;
+  }
+  if (t == 0xde || t == 0xdf) {
+    cur->p++;
+    return mp_take_uint(cur, 2 << (t - 0xde), count);
+  }
+
+  return mp_read(cur, &val, depth);
+}
+
+static gboolean
+mp_peek_map(const struct mp_cursor *cur)
+{
+  return cur->p < cur->end && ((*cur->p & 0xf0) == 0x80 || *cur->p == 0xde || *cur->p == 0xdf);
+}
+
+static gboolean
+mp_peek_array(const struct mp_cursor *cur)
+{
+  return cur->p < cur->end && ((*cur->p & 0xf0) == 0x90 || *cur->p == 0xdc || *cur->p == 0xdd);
+}
+
+/* Reads the header of an array, only valid after mp_peek_array(). */
+static gboolean
+mp_read_array(struct mp_cursor *cur, guint64 *count)
+{
+  guchar t = *cur->p++;
+
+  if ((t & 0xf0) == 0x90) {
+    *count = t & 0x0f;
+    return TRUE;
+  }
+
+  return mp_take_uint(cur, 2 << (t - 0xdc), count);
+}
+
+static gboolean
+mp_key_is(const struct mp_value *key, const gchar *name, gsize len)
+{
+  return key->type == MP_STR && key->len == len && memcmp(key->str, name, len) == 0;
+}
+
+static gchar *
+mp_strdup(const struct mp_value *val)
+{
+  if (val->type == MP_STR) {
+    return g_strndup(val->str, val->len);
+  }
+  if (val->type == MP_UINT) {
+    return g_strdup_printf("%" G_GUINT64_FORMAT, val->u);
+  }
+
+  return NULL;
+}
+
+static gboolean
+msgpack_string_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_STR) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected a string");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_enum_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_string_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_int_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_INT) {
+    *c = candidate_new_int(val.i);
+  } else if (val.type == MP_STR || val.type == MP_UINT) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected an integer or a string");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_regex_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  GPtrArray *patterns = NULL;
+  struct mp_value val;
+  guint64 invalid = G_MAXUINT64;
+  guint64 count;
+
+  *c = NULL;
+  if (!mp_peek_array(cur)) {
+    if (!mp_read(cur, &val, depth)) {
+      return FALSE;
+    }
+    if (val.type == MP_STR) {
+      *c = candidate_new_string(mp_strdup(&val));
+    } else {
+      *c = candidate_new_invalid("expected a string or an array of strings");
+    }
+    return TRUE;
+  }
+  if (depth >= MP_MAX_DEPTH || !mp_read_array(cur, &count)) {
+    return FALSE;
+  }
+
+  patterns = g_ptr_array_new_with_free_func(g_free);
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &val, depth + 1)) {
+      g_ptr_array_unref(patterns);
+      return FALSE;
+    }
+    if (val.type != MP_STR) {
+      invalid = MIN(invalid, i);
+      continue;
+    }
+    g_ptr_array_add(patterns, mp_strdup(&val));
+  }
+
+  if (invalid != G_MAXUINT64) {
+    g_ptr_array_unref(patterns);
+    *c = candidate_new_invalid("element %" G_GUINT64_FORMAT " is not a string", invalid);
+    return TRUE;
+  }
+
+  g_ptr_array_set_free_func(patterns, NULL);
+  g_ptr_array_add(patterns, NULL);
+  *c = candidate_new_strv((gchar **) g_ptr_array_free(patterns, FALSE));
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_glob_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_regex_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_file_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_string_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_map_routes_entry(struct mp_cursor *cur, gint depth, struct candidate_entry *e)
+{
+  struct candidate *field = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "backend", 7)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &field)) {
+        return FALSE;
+      }
+      candidate_free(e->fields[0]);
+      e->fields[0] = field;
+      continue;
+    }
+    if (mp_key_is(&key, "weight", 6)) {
+      if (!msgpack_int_candidate(cur, depth + 1, &field)) {
+        return FALSE;
+      }
+      candidate_free(e->fields[1]);
+      e->fields[1] = field;
+      continue;
+    }
+    if (mp_key_is(&key, "mode", 4)) {
+      if (!msgpack_enum_candidate(cur, depth + 1, &field)) {
+        return FALSE;
+      }
+      candidate_free(e->fields[2]);
+      e->fields[2] = field;
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_map_routes_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct candidate_entry *e = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  *c = NULL;
+  if (!mp_peek_map(cur)) {
+    if (!mp_read(cur, &key, depth)) {
+      return FALSE;
+    }
+    *c = candidate_new_invalid("expected an object");
+    return TRUE;
+  }
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  /* Every entry takes at least two bytes, so do not trust larger counts. */
+  *c = candidate_new_map(MIN(count, (guint64)(cur->end - cur->p) / 2));
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      goto err;
+    }
+    if (key.type != MP_STR) {
+      if (!mp_read(cur, &key, depth + 1)) {
+        goto err;
+      }
+      continue;
+    }
+    e = candidate_entry_new(mp_strdup(&key), 3);
+    g_ptr_array_add((*c)->entries, e);
+    if (!mp_peek_map(cur)) {
+      e->invalid = TRUE;
+      if (!mp_read(cur, &key, depth + 1)) {
+        goto err;
+      }
+      continue;
+    }
+    if (!msgpack_map_routes_entry(cur, depth + 1, e)) {
+      goto err;
+    }
+  }
+
+  return TRUE;
+
+err:
+  g_clear_pointer(c, candidate_free);
+  return FALSE;
+}
+
+static gboolean
+msgpack_object_root_allow(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "paths", 5)) {
+      if (!msgpack_glob_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "allow.paths", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_object_root_resolver(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "hosts", 5)) {
+      if (!msgpack_file_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "resolver.hosts", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_object_root(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "allow", 5)) {
+      if (!msgpack_object_root_allow(candidates, cur, depth + 1)) {
+        return FALSE;
+      }
+      continue;
+    }
+    if (mp_key_is(&key, "resolver", 8)) {
+      if (!msgpack_object_root_resolver(candidates, cur, depth + 1)) {
+        return FALSE;
+      }
+      continue;
+    }
+    if (mp_key_is(&key, "routes", 6)) {
+      if (!msgpack_map_routes_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "routes", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+parse_msgpack_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  GMappedFile *map = NULL;
+  struct mp_cursor cur;
+  GError *local_err = NULL;
+  gboolean ok;
+
+  g_assert(candidates);
+  g_assert(file);
+
+  map = g_mapped_file_new(file, FALSE, &local_err);
+  if (map == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: %s",
+                file,
+                local_err->message);
+    g_clear_error(&local_err);
+    return FALSE;
+  }
+
+  cur.p = (const guchar *) g_mapped_file_get_contents(map);
+  cur.end = cur.p + g_mapped_file_get_length(map);
+
+  /* Like json_load_file, reject anything after the root value. */
+  ok = msgpack_object_root(candidates, &cur, 0) && cur.p == cur.end;
+  g_mapped_file_unref(map);
+
+  if (!ok) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: malformed msgpack",
+                file);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/* Relative paths given in a config file are relative to that file. */
+static void
+resolve_path(GHashTable *candidates, const gchar *name, const gchar *file)
+{
+  struct candidate *c = NULL;
+  gchar *dir = NULL;
+  gchar *path = NULL;
+
+  c = g_hash_table_lookup(candidates, name);
+  if (c == NULL || c->str == NULL || g_path_is_absolute(c->str)) {
+    return;
+  }
+
+  dir = g_path_get_dirname(file);
+  path = g_build_filename(dir, c->str, NULL);
+  g_free(c->str);
+  c->str = path;
+  g_free(dir);
+}
+
+/* Only merges into candidates once the whole file has been decoded. */
+static gboolean
+parse_config_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  GHashTable *parsed = NULL;
+  GHashTableIter iter;
+  gpointer name;
+  gpointer c;
+  gboolean ok;
+
+  parsed = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  if (g_str_has_suffix(file, ".msgpack")) {
+    ok = parse_msgpack_file(parsed, file, err);
+  } else {
+    ok = parse_json_file(parsed, file, err);
+  }
+
+  if (ok) {
+    resolve_path(parsed, "resolver.hosts", file);
+    g_hash_table_iter_init(&iter, parsed);
+    while (g_hash_table_iter_next(&iter, &name, &c)) {
+      g_hash_table_iter_steal(&iter);
+      (void) g_hash_table_replace(candidates, name, c);
+    }
+  }
+  g_hash_table_unref(parsed);
+
+  return ok;
+}
+
+static gboolean
+parse_config(GHashTable *candidates, GError **err)
+{
+  gchar *file = NULL;
+  gboolean ok;
+
+  file = get_config_file();
+  ok = parse_config_file(candidates, file, err);
+  g_free(file);
+
+  return ok;
+}
+
+/* Every setter starts with this, so that a value of the wrong type is
+ * reported rather than replaced by the default. */
+static gboolean
+check_candidate(const gchar *name, const struct candidate *c, GError **err)
+{
+  if (c != NULL && c->type == CANDIDATE_INVALID) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid value: %s",
+                name, c->str);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+check_string(const gchar *name, const struct candidate *c, gint64 min, gint64 max, gint options, const gchar* opts[], GError **err)
+{
+  const gchar *str;
+
+  g_assert(name);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL || c->str == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+  str = c->str;
+
+  if (strlen(str) < min) {
+    g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_SMALL,
+                  "Parameter %s too short (min %ld chars)",
+                  name, min);
+    return FALSE;
+  }
+
+  if (strlen(str) > max) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_BIG,
+                  "Parameter %s too long (max %ld chars)",
+                  name, max);
+    return FALSE;
+  }
+
+  if (options > 0) {
+    gboolean ok = FALSE;
+    for (gint i = 0; i < options; i++) {
+        if (g_strcmp0(opts[i], str) == 0) {
+            ok = TRUE;
+            break;
+        }
+    }
+    if (!ok) {
+      g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+set_string_chunk(const gchar *name, const struct candidate *c, const gchar **dst, GStringChunk *chunk, gint64 min, gint64 max, gint options, const gchar* opts[], GError **err)
+{
+  g_assert(dst);
+  g_assert(chunk);
+
+  if (!check_string(name, c, min, max, options, opts, err)) {
+    return FALSE;
+  }
+
+  *dst = g_string_chunk_insert(chunk, c->str);
+
+  return TRUE;
+}
+
+static gboolean
+set_int(const gchar *name, const struct candidate *c, gint64 *dst, gint64 min, gint64 max, gint options, const gint64 *opts, GError **err)
+{
+  const gchar *str;
+  gint64 tmp;
+  gchar *endp;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+
+  if (c->type == CANDIDATE_INT) {
+    tmp = c->i;
+    goto validate;
+  }
+  str = c->str;
+
+  tmp = g_ascii_strtoll(str, &endp, 10);
+
+  if (tmp == 0 && endp == str) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid value",
+                name);
+    return FALSE;
+  }
+
+  if (tmp == G_MAXINT64 && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_BIG,
+                "Parameter %s too big (max %ld)",
+                name, max);
+    return FALSE;
+  }
+
+  if (tmp == G_MININT64 && errno == ERANGE) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %ld)",
+                name, min);
+    return FALSE;
+  }
+
+validate:
+  if (tmp < min) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %ld)",
+                 name, min);
+    return FALSE;
+  }
+
+  if (tmp > max) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_TOO_BIG,
+                  "Parameter %s too big (max %ld)",
+                  name, max);
+    return FALSE;
+  }
+
+  if (options > 0) {
+    gboolean ok = FALSE;
+    for (gint i = 0; i < options; i++) {
+        if (opts[i] == tmp) {
+            ok = TRUE;
+            break;
+        }
+    }
+    if (!ok) {
+      g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+      return FALSE;
+    }
+  }
+
+  *dst = tmp;
+
+  return TRUE;
+}
+
+static gchar *
+glob_to_regex(const gchar *glob)
+{
+  GString *out = NULL;
+
+  out = g_string_sized_new(strlen(glob) * 2);
+  for (const gchar *p = glob; *p != '\0'; p++) {
+    switch (*p) {
+    case '*':
+      g_string_append(out, ".*");
+      break;
+    case '?':
+      g_string_append_c(out, '.');
+      break;
+    default:
+      /* Escaping any other ascii punctuation always makes it a literal. */
+      if (g_ascii_ispunct(*p)) {
+        g_string_append_c(out, '\\');
+      }
+      g_string_append_c(out, *p);
+    }
+  }
+
+  return g_string_free(out, FALSE);
+}
+
+/* Group numbers run on across combined patterns, so a backreference or a
+ * subroutine call by number in one pattern would refer to another. */
+static gboolean
+has_group_reference(const gchar *pattern, const GRegex *regex)
+{
+  if (g_regex_get_max_backref(regex) > 0) {
+    return TRUE;
+  }
+
+  for (const gchar *p = pattern; (p = strstr(p, "(?")) != NULL; p += 2) {
+    if (p > pattern && p[-1] == '\\') {
+      continue;
+    }
+    if (g_ascii_isdigit(p[2]) || p[2] == 'R' || p[2] == '&' ||
+        ((p[2] == '+' || p[2] == '-') && g_ascii_isdigit(p[3])) ||
+        g_str_has_prefix(p + 2, "P>")) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static gboolean
+check_pattern(const gchar *name, const gchar *pattern, gint64 min, gint64 max, gboolean compile, GError **err)
+{
+  GRegex *regex = NULL;
+  GError *local_err = NULL;
+
+  if (strlen(pattern) < min) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too short (min %ld chars)",
+                name, min);
+    return FALSE;
+  }
+
+  if (strlen(pattern) > max) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_BIG,
+                "Parameter %s too long (max %ld chars)",
+                name, max);
+    return FALSE;
+  }
+
+  if (!compile) {
+    return TRUE;
+  }
+
+  regex = g_regex_new(pattern, 0, 0, &local_err);
+  if (regex == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid pattern: %s",
+                name, local_err->message);
+    g_clear_error(&local_err);
+    return FALSE;
+  }
+
+  if (has_group_reference(pattern, regex)) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has a pattern with group references, which are only allowed in a single pattern",
+                name);
+    g_regex_unref(regex);
+    return FALSE;
+  }
+  g_regex_unref(regex);
+
+  return TRUE;
+}
+
+/* Compiled patterns by source and flags. Fleets share their allowlists,
+ * so validating many files compiles each one once. Unlike the file cache
+ * this holds a reference, and is emptied when full to stay bounded. */
+#define PATTERN_CACHE_SIZE 64
+
+static GMutex pattern_cache_lock;
+static GHashTable *pattern_cache = NULL;
+
+static GRegex *
+lookup_pattern(const gchar *key)
+{
+  GRegex *regex = NULL;
+
+  g_mutex_lock(&pattern_cache_lock);
+  if (pattern_cache != NULL) {
+    regex = g_hash_table_lookup(pattern_cache, key);
+  }
+  if (regex != NULL) {
+    g_regex_ref(regex);
+  }
+  g_mutex_unlock(&pattern_cache_lock);
+
+  return regex;
+}
+
+static void
+store_pattern(const gchar *key, GRegex *regex)
+{
+  g_mutex_lock(&pattern_cache_lock);
+  if (pattern_cache == NULL) {
+    pattern_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_regex_unref);
+  }
+  if (g_hash_table_size(pattern_cache) >= PATTERN_CACHE_SIZE) {
+    g_hash_table_remove_all(pattern_cache);
+  }
+  g_hash_table_replace(pattern_cache, g_strdup(key), g_regex_ref(regex));
+  g_mutex_unlock(&pattern_cache_lock);
+}
+
+/* Compiles all patterns of c into a single regex so that matching an
+ * allowlist is one pass over the input. Globs match the whole string. */
+static gboolean
+set_pattern(const gchar *name, const struct candidate *c, GRegex **dst, gint64 min, gint64 max, gboolean glob, GError **err)
+{
+  const gchar *single[] = { NULL, NULL };
+  const gchar * const *patterns;
+  GRegexCompileFlags flags = G_REGEX_OPTIMIZE;
+  GString *combined = NULL;
+  GRegex *regex = NULL;
+  GError *local_err = NULL;
+  gchar *key = NULL;
+  guint n;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL || (c->str == NULL && c->strv == NULL)) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+
+  if (c->strv != NULL) {
+    patterns = (const gchar * const *) c->strv;
+  } else {
+    single[0] = c->str;
+    patterns = single;
+  }
+  n = g_strv_length((gchar **) patterns);
+
+  combined = g_string_new(glob ? "\\A(?:" : "");
+  for (guint i = 0; i < n; i++) {
+    if (!check_pattern(name, patterns[i], min, max, FALSE, err)) {
+      g_string_free(combined, TRUE);
+      return FALSE;
+    }
+
+    if (i > 0) {
+      g_string_append_c(combined, '|');
+    }
+    if (glob) {
+      gchar *tmp = glob_to_regex(patterns[i]);
+      g_string_append(combined, tmp);
+      g_free(tmp);
+    } else if (n > 1) {
+      g_string_append_printf(combined, "(?:%s)", patterns[i]);
+    } else {
+      g_string_append(combined, patterns[i]);
+    }
+  }
+
+  if (n == 0) {
+    /* An empty allowlist matches nothing. */
+    g_string_append(combined, "(?!)");
+  }
+
+  if (glob) {
+    g_string_append(combined, ")\\z");
+    flags |= G_REGEX_DOTALL;
+  }
+
+  key = g_strdup_printf("%x:%s", flags, combined->str);
+  regex = lookup_pattern(key);
+  if (regex != NULL) {
+    goto out;
+  }
+
+  /* Regexes are only wrapped in a group when there are several of them,
+   * so each one is compiled on its own first to reject patterns such as
+   * "a)|(b" that are only valid once combined, or that refer to groups. */
+  if (!glob && n > 1) {
+    for (guint i = 0; i < n; i++) {
+      if (!check_pattern(name, patterns[i], min, max, TRUE, err)) {
+        goto err;
+      }
+    }
+  }
+
+  regex = g_regex_new(combined->str, flags, 0, &local_err);
+  if (regex == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid pattern: %s",
+                name, local_err->message);
+    g_clear_error(&local_err);
+    goto err;
+  }
+  store_pattern(key, regex);
+
+out:
+  g_string_free(combined, TRUE);
+  g_free(key);
+  *dst = regex;
+
+  return TRUE;
+
+err:
+  g_string_free(combined, TRUE);
+  g_free(key);
+
+  return FALSE;
+}
+
+/* The mappings held by parsed configs, by path. A reload of a file that
+ * has not changed since reuses the mapping instead of reading it again.
+ * The cache holds no reference of its own: an entry is dropped when the
+ * last config using it is cleared, which unmaps the file. */
+struct file_cache_entry {
+  GMappedFile *map;
+  guint users;
+  guint64 dev;
+  guint64 ino;
+  gint64 size;
+  gint64 mtime;
+  gint64 ctime;
+};
+
+static GMutex file_cache_lock;
+static GHashTable *file_cache = NULL;
+
+static GMappedFile *
+map_file(const gchar *path, gint fd, const struct stat *st, GError **err)
+{
+  struct file_cache_entry *entry = NULL;
+  GMappedFile *map = NULL;
+
+  g_mutex_lock(&file_cache_lock);
+
+  if (file_cache == NULL) {
+    file_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  entry = g_hash_table_lookup(file_cache, path);
+  if (entry != NULL &&
+      entry->dev == (guint64) st->st_dev &&
+      entry->ino == (guint64) st->st_ino &&
+      entry->size == (gint64) st->st_size &&
+      entry->mtime == (gint64) st->st_mtime &&
+      entry->ctime == (gint64) st->st_ctime) {
+    map = g_mapped_file_ref(entry->map);
+    entry->users++;
+    goto out;
+  }
+
+  map = g_mapped_file_new_from_fd(fd, FALSE, err);
+  if (map == NULL) {
+    goto out;
+  }
+
+  /* A changed file replaces the entry, configs still holding the old
+   * mapping release it on their own when cleared. */
+  entry = g_new0(struct file_cache_entry, 1);
+  entry->map = map;
+  entry->users = 1;
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime = st->st_mtime;
+  entry->ctime = st->st_ctime;
+  g_hash_table_replace(file_cache, g_strdup(path), entry);
+
+out:
+  g_mutex_unlock(&file_cache_lock);
+
+  return map;
+}
+
+static void
+clear_file(struct config_file *file)
+{
+  struct file_cache_entry *entry = NULL;
+
+  if (file->map != NULL) {
+    g_mutex_lock(&file_cache_lock);
+    entry = g_hash_table_lookup(file_cache, file->path);
+    if (entry != NULL && entry->map == file->map && --entry->users == 0) {
+      g_hash_table_remove(file_cache, file->path);
+    }
+    g_mutex_unlock(&file_cache_lock);
+  }
+
+  g_clear_pointer(&file->map, g_mapped_file_unref);
+  g_clear_pointer(&file->path, g_free);
+  file->data = NULL;
+  file->size = 0;
+}
+
+static gboolean
+set_file(const gchar *name, const struct candidate *c, struct config_file *dst, gint64 min, gint64 max, GError **err)
+{
+  GMappedFile *map = NULL;
+  GError *local_err = NULL;
+  struct stat st;
+  gint fd;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL || c->str == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NOT_SET,
+                "Parameter %s not set",
+                name);
+    return FALSE;
+  }
+
+  /* Stat the open file so that the size check and the mapping are done on
+   * the same inode even if the path is replaced meanwhile. */
+  fd = g_open(c->str, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Parameter %s could not read %s: %s",
+                name, c->str, g_strerror(errno));
+    if (fd >= 0) {
+      g_close(fd, NULL);
+    }
+    return FALSE;
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Parameter %s: %s is not a regular file",
+                name, c->str);
+    g_close(fd, NULL);
+    return FALSE;
+  }
+
+  if (st.st_size < min) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s too small (min %ld bytes)",
+                name, min);
+    g_close(fd, NULL);
+    return FALSE;
+  }
+
+  if (st.st_size > max) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_BIG,
+                "Parameter %s too big (max %ld bytes)",
+                name, max);
+    g_close(fd, NULL);
+    return FALSE;
+  }
+
+  map = map_file(c->str, fd, &st, &local_err);
+  g_close(fd, NULL);
+
+  if (map == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Parameter %s could not map %s: %s",
+                name, c->str, local_err->message);
+    g_clear_error(&local_err);
+    return FALSE;
+  }
+
+  dst->map = map;
+  dst->data = g_mapped_file_get_contents(map);
+  dst->size = g_mapped_file_get_length(map);
+  dst->path = g_strdup(c->str);
+
+  return TRUE;
+}
+
+
+static gboolean
+set_enum_routes_mode(const gchar *name, const struct candidate *c, enum config_routes_mode *dst, GError **err)
+{
+  const gchar *str;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c == NULL || c->str == NULL) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_NOT_SET,
+                  "Parameter %s not set",
+                  name);
+    return FALSE;
+  }
+  str = c->str;
+  if (g_strcmp0(str, "fast") == 0) {
+    *dst = ROUTES_MODE_FAST;
+    return TRUE;
+  }
+  if (g_strcmp0(str, "safe") == 0) {
+    *dst = ROUTES_MODE_SAFE;
+    return TRUE;
+  }
+
+  g_set_error(err,
+              CONFIG_ERROR,
+              ERROR_CONFIG_INVALID,
+              "Parameter %s has an invalid value",
+              name);
+
+  return FALSE;
+}
+
+
+
+static void
+clear_map_routes(struct config_routes *map)
+{
+  g_free(map->entries);
+  if (map->keys != NULL) {
+    g_string_chunk_free(map->keys);
+  }
+  memset(map, 0, sizeof(*map));
+}
+
+static gboolean
+set_map_routes(const gchar *name, const struct candidate *c, struct config_routes *dst, gint64 min, gint64 max, GError **err)
+{
+  static const struct candidate default_routes_weight = { .type = CANDIDATE_STRING, .str = (gchar *) "1" };
+  static const struct candidate default_routes_mode = { .type = CANDIDATE_STRING, .str = (gchar *) "fast" };
+  struct config_routes_entry *entry = NULL;
+  struct config_routes_value value;
+  struct candidate_entry *e = NULL;
+  guint size = 0;
+  guint capacity = 8;
+  guint32 hash;
+  guint32 idx;
+
+  g_assert(name);
+  g_assert(dst);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!check_candidate(name, c, err)) {
+    return FALSE;
+  }
+
+  if (c != NULL && c->type != CANDIDATE_MAP) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_INVALID,
+                "Parameter %s has an invalid value",
+                name);
+    return FALSE;
+  }
+
+  if (c != NULL) {
+    size = c->entries->len;
+  }
+
+  if (size < min) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_SMALL,
+                "Parameter %s has too few entries (min %ld)",
+                name, min);
+    return FALSE;
+  }
+
+  if (size > max) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_TOO_BIG,
+                "Parameter %s has too many entries (max %ld)",
+                name, max);
+    return FALSE;
+  }
+
+  /* Keep the load factor at or below one half so probe chains stay short. */
+  while (capacity < size * 2) {
+    capacity *= 2;
+  }
+
+  dst->entries = g_new0(struct config_routes_entry, capacity);
+  dst->mask = capacity - 1;
+  dst->size = 0;
+  dst->keys = g_string_chunk_new(4096);
+
+  for (guint i = 0; i < size; i++) {
+    e = g_ptr_array_index(c->entries, i);
+    memset(&value, 0, sizeof(value));
+
+    if (e->invalid) {
+      g_set_error(err,
+                  CONFIG_ERROR,
+                  ERROR_CONFIG_INVALID,
+                  "%s[\"%s\"]: invalid value",
+                  name, e->key);
+      clear_map_routes(dst);
+      return FALSE;
+    }
+    if (!set_string_chunk("backend", e->fields[0], &value.backend, dst->keys, 1, 64, 0, NULL, err)) {
+      g_prefix_error(err, "%s[\"%s\"]: ", name, e->key);
+      clear_map_routes(dst);
+      return FALSE;
+    }
+    if (!set_int("weight", e->fields[1] != NULL ? e->fields[1] : &default_routes_weight, &value.weight, 0, 100, 0, NULL, err)) {
+      g_prefix_error(err, "%s[\"%s\"]: ", name, e->key);
+      clear_map_routes(dst);
+      return FALSE;
+    }
+    if (!set_enum_routes_mode("mode", e->fields[2] != NULL ? e->fields[2] : &default_routes_mode, &value.mode, err)) {
+      g_prefix_error(err, "%s[\"%s\"]: ", name, e->key);
+      clear_map_routes(dst);
+      return FALSE;
+    }
+
+    hash = g_str_hash(e->key);
+    for (idx = hash & dst->mask; dst->entries[idx].key != NULL; idx = (idx + 1) & dst->mask) {
+      if (dst->entries[idx].hash == hash && strcmp(dst->entries[idx].key, e->key) == 0) {
+        break;
+      }
+    }
+
+    entry = &dst->entries[idx];
+    if (entry->key == NULL) {
+      entry->key = g_string_chunk_insert(dst->keys, e->key);
+      entry->hash = hash;
+      dst->size++;
+    }
+    entry->value = value;
+  }
+
+  return TRUE;
+}
+
+
+static gboolean
+check_and_set(struct config_network *cfg, GHashTable *candidates, GError **err)
+{
+
+  g_assert(cfg);
+  g_assert(candidates);
+  g_assert(err != NULL && *err == NULL);
+    if (!set_pattern("allow.paths", g_hash_table_lookup(candidates, "allow.paths"), &cfg->allow.paths, 1, 256, TRUE, err)) {
+        return FALSE;
+    }
+    if (!set_file("resolver.hosts", g_hash_table_lookup(candidates, "resolver.hosts"), &cfg->resolver.hosts, 0, 16777216, err)) {
+        return FALSE;
+    }
+    if (!set_map_routes("routes", g_hash_table_lookup(candidates, "routes"), &cfg->routes, 0, 100000, err)) {
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+check_all(struct config_network *cfg, GHashTable *candidates, config_error_func func, gpointer user_data)
+{
+  GError *local_err = NULL;
+  GError **err = &local_err;
+  gboolean ok = TRUE;
+
+  g_assert(cfg);
+  g_assert(candidates);
+  g_assert(func);
+    if (!set_pattern("allow.paths", g_hash_table_lookup(candidates, "allow.paths"), &cfg->allow.paths, 1, 256, TRUE, err)) {
+        func("allow.paths", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_file("resolver.hosts", g_hash_table_lookup(candidates, "resolver.hosts"), &cfg->resolver.hosts, 0, 16777216, err)) {
+        func("resolver.hosts", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+    if (!set_map_routes("routes", g_hash_table_lookup(candidates, "routes"), &cfg->routes, 0, 100000, err)) {
+        func("routes", local_err, user_data);
+        g_clear_error(&local_err);
+        ok = FALSE;
+    }
+
+  return ok;
+}
+
+gboolean
+config_network_check_and_set(struct config_network *cfg, GHashTable *candidates, GError **err)
+{
+  return check_and_set(cfg, candidates, err);
+}
+
+gboolean
+config_network_check_all(struct config_network *cfg, GHashTable *candidates, config_error_func func, gpointer user_data)
+{
+  return check_all(cfg, candidates, func, user_data);
+}
+
+/* Reads the sources that take precedence over the config file. Both come
+ * from process state, so this always runs on the calling thread. */
+static gboolean
+parse_overrides(GHashTable *overrides, gint *argc, gchar **argv[], GError **err)
+{
+  g_assert(overrides);
+
+  return TRUE;
+}
+
+/* Reads the defaults and the config file, applies overrides on top and
+ * validates the result into cfg. Overrides are moved, not copied. */
+static gboolean
+parse_sources(struct config_network *cfg, GHashTable *overrides, gboolean die_on_json_error, GError **err)
+{
+  GHashTable * candidates = NULL;
+  GHashTableIter iter;
+  gpointer name;
+  gpointer c;
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+
+
+  if (die_on_json_error) {
+    if (!parse_config(candidates, err)) {
+        goto err;
+    }
+  } else {
+    (void)parse_config(candidates, NULL);
+  }
+
+  g_hash_table_iter_init(&iter, overrides);
+  while (g_hash_table_iter_next(&iter, &name, &c)) {
+    g_hash_table_iter_steal(&iter);
+    (void) g_hash_table_replace(candidates, name, c);
+  }
+
+  if (!check_and_set(cfg, candidates, err)) {
+    goto err;
+  }
+  g_hash_table_remove_all(candidates);
+  g_clear_pointer(&candidates, g_hash_table_unref);
+
+  return TRUE;
+
+err:
+  g_hash_table_remove_all(candidates);
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_network_clear(cfg);
+
+  return FALSE;
+}
+
+gboolean
+config_network_parse(struct config_network *cfg, gint argc, gchar *argv[], gboolean die_on_json_error, GError **err) {
+  GHashTable *overrides = NULL;
+  gboolean ok = FALSE;
+
+  overrides = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  if (parse_overrides(overrides, &argc, &argv, err)) {
+    ok = parse_sources(cfg, overrides, die_on_json_error, err);
+  }
+  g_clear_pointer(&overrides, g_hash_table_unref);
+
+  return ok;
+}
+
+struct parse_task {
+  GHashTable *overrides;
+  gboolean die_on_json_error;
+  struct config_network cfg;
+};
+
+static void
+parse_task_free(gpointer data)
+{
+  struct parse_task *t = data;
+
+  g_clear_pointer(&t->overrides, g_hash_table_unref);
+  config_network_clear(&t->cfg);
+  g_free(t);
+}
+
+static void
+parse_thread(GTask *task, gpointer source, gpointer data, GCancellable *cancellable)
+{
+  struct parse_task *t = data;
+  GError *err = NULL;
+
+  if (g_task_return_error_if_cancelled(task)) {
+    return;
+  }
+
+  if (!parse_sources(&t->cfg, t->overrides, t->die_on_json_error, &err)) {
+    g_task_return_error(task, err);
+    return;
+  }
+
+  g_task_return_boolean(task, TRUE);
+}
+
+void
+config_network_parse_async(gint argc, gchar *argv[], gboolean die_on_json_error, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+  struct parse_task *t = NULL;
+  GTask *task = NULL;
+  GError *err = NULL;
+
+  task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, config_network_parse_async);
+
+  t = g_new0(struct parse_task, 1);
+  t->overrides = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+  t->die_on_json_error = die_on_json_error;
+  g_task_set_task_data(task, t, parse_task_free);
+
+  if (!parse_overrides(t->overrides, &argc, &argv, &err)) {
+    g_task_return_error(task, err);
+  } else {
+    g_task_run_in_thread(task, parse_thread);
+  }
+
+  g_object_unref(task);
+}
+
+gboolean
+config_network_parse_finish(struct config_network *cfg, GAsyncResult *result, GError **err)
+{
+  struct parse_task *t = NULL;
+
+  g_assert(cfg);
+  g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+
+  if (!g_task_propagate_boolean(G_TASK(result), err)) {
+    return FALSE;
+  }
+
+  t = g_task_get_task_data(G_TASK(result));
+  *cfg = t->cfg;
+  memset(&t->cfg, 0, sizeof(t->cfg));
+
+  return TRUE;
+}
+
+gboolean
+config_network_check_file(const gchar *file, config_error_func func, gpointer user_data)
+{
+  struct config_network cfg = {};
+  GHashTable *candidates = NULL;
+  GError *err = NULL;
+  gboolean ok = FALSE;
+
+  g_assert(file);
+  g_assert(func);
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+  if (!parse_config_file(candidates, file, &err)) {
+    func("", err, user_data);
+    g_clear_error(&err);
+    goto out;
+  }
+
+  ok = check_all(&cfg, candidates, func, user_data);
+
+out:
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_network_clear(&cfg);
+
+  return ok;
+}
+
+gboolean
+config_network_parse_file(struct config_network *cfg, const gchar *file, GError **err)
+{
+  GHashTable *candidates = NULL;
+
+  g_assert(cfg);
+  g_assert(file);
+  g_assert(err != NULL && *err == NULL);
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+  if (!parse_config_file(candidates, file, err)) {
+    goto err;
+  }
+
+  if (!check_and_set(cfg, candidates, err)) {
+    goto err;
+  }
+  g_clear_pointer(&candidates, g_hash_table_unref);
+
+  return TRUE;
+
+err:
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_network_clear(cfg);
+
+  return FALSE;
+}
+
+
+const gchar *
+config_name_enum_routes_mode(enum config_routes_mode val)
+{
+    switch (val) {
+    case ROUTES_MODE_FAST:
+      return "fast";
+    case ROUTES_MODE_SAFE:
+      return "safe";
+    default:
+      g_assert_not_reached();
+    }
+
+    return "";
+}
+
+
+
+const struct config_routes_value *
+config_lookup_routes(const struct config_network *cfg, const gchar *key)
+{
+  const struct config_routes *map = &cfg->routes;
+  guint32 hash;
+
+  g_assert(cfg);
+  g_assert(key);
+
+  if (map->entries == NULL) {
+    return NULL;
+  }
+
+  hash = g_str_hash(key);
+  for (guint32 idx = hash & map->mask; map->entries[idx].key != NULL; idx = (idx + 1) & map->mask) {
+    if (map->entries[idx].hash == hash && strcmp(map->entries[idx].key, key) == 0) {
+      return &map->entries[idx].value;
+    }
+  }
+
+  return NULL;
+}
+
+
+
+gboolean
+config_match_allow_paths(const struct config_network *cfg, const gchar *str)
+{
+  g_assert(cfg);
+  g_assert(str);
+
+  /* GRegex requires valid UTF-8, and str is typically untrusted. */
+  if (!g_utf8_validate(str, -1, NULL)) {
+    return FALSE;
+  }
+
+  return cfg->allow.paths != NULL && g_regex_match(cfg->allow.paths, str, 0, NULL);
+}
+
+
+void
+config_network_clear(struct config_network *cfg)
+{
+  g_clear_pointer(&cfg->allow.paths, g_regex_unref);
+  clear_map_routes(&cfg->routes);
+  clear_file(&cfg->resolver.hosts);
+  memset(cfg, 0, sizeof(*cfg));
+}
+
+gchar *
+config_network_to_string(struct config_network *cfg)
+{
+  return g_strdup_printf("allow.paths: %s\n"
+"resolver.hosts: %s (%lu bytes)\n"
+"routes: %u entries\n"
+,
+  cfg->allow.paths ? g_regex_get_pattern(cfg->allow.paths) : "",
+  cfg->resolver.hosts.path,
+  cfg->resolver.hosts.size,
+  cfg->routes.size);
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+
+#ifndef _CONFIG_NETWORK_H_
+#define _CONFIG_NETWORK_H_
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "config-common.h"
+
+
+enum config_routes_mode {
+    ROUTES_MODE_FAST,
+    ROUTES_MODE_SAFE,
+};
+
+
+
+
+struct config_routes_value {
+    const gchar *backend; /** Backend host */
+    gint64 weight; /**  */
+    enum config_routes_mode mode; /**  */
+};
+
+struct config_routes_entry {
+  const gchar *key;
+  guint32 hash;
+  struct config_routes_value value;
+};
+
+/* Open addressing table with linear probing. Keys and string values are
+ * stored in the keys chunk. */
+struct config_routes {
+  struct config_routes_entry *entries;
+  guint32 mask;
+  guint32 size;
+  GStringChunk *keys;
+};
+
+
+struct config_network_allow {
+    GRegex *paths; /** Paths that may be served */
+};
+
+struct config_network_resolver {
+    struct config_file hosts; /** Static host table */
+};
+
+struct config_network {
+    struct config_network_allow allow; /**  */
+    struct config_network_resolver resolver; /**  */
+    struct config_routes routes; /** Per route backend settings */
+};
+
+
+gboolean
+config_network_parse(struct config_network *cfg, gint argc, gchar *argv[], gboolean die_on_json_error, GError **err);
+
+/* Runs config_network_parse on a worker thread. The environment and command line
+ * are read before returning, file I/O and validation happen on the thread.
+ * callback is invoked in the thread-default main context of the caller. */
+void
+config_network_parse_async(gint argc, gchar *argv[], gboolean die_on_json_error, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+/* Moves the parsed config into cfg, which is left untouched on error. */
+gboolean
+config_network_parse_finish(struct config_network *cfg, GAsyncResult *result, GError **err);
+
+/* Validates the candidates read by the composed config.c into cfg. */
+gboolean
+config_network_check_and_set(struct config_network *cfg, GHashTable *candidates, GError **err);
+
+gboolean
+config_network_check_all(struct config_network *cfg, GHashTable *candidates, config_error_func func, gpointer user_data);
+
+void
+config_network_clear(struct config_network *cfg);
+
+gboolean
+config_network_check_file(const gchar *file, config_error_func func, gpointer user_data);
+
+/* Like config_network_parse but only reads the defaults and the given json or
+ * msgpack file, ignoring the environment and command line. */
+gboolean
+config_network_parse_file(struct config_network *cfg, const gchar *file, GError **err);
+
+gchar *
+config_network_to_string(struct config_network *cfg);
+
+
+const struct config_routes_value *
+config_lookup_routes(const struct config_network *cfg, const gchar *key);
+
+
+/* Matches str against the allow.paths patterns. str may be untrusted input,
+ * a string that is not valid UTF-8 never matches. */
+gboolean
+config_match_allow_paths(const struct config_network *cfg, const gchar *str);
+
+
+const gchar *
+config_name_enum_routes_mode(enum config_routes_mode val);
+
+#endif /* _CONFIG_NETWORK_H_ */
+
+
@@ -1,21 +1,183 @@
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <jansson.h>
 #include <math.h>
+#include <sys/stat.h>
 
 #include "config.h"
 
+/* Numbers read from json or msgpack are kept in their native type so they
+ * do not take a trip through a string before being validated. A value of
+ * the wrong type is kept as invalid, with the reason in str, so that it is
+ * reported instead of falling back to the default. */
+enum candidate_type {
+  CANDIDATE_STRING,
+  CANDIDATE_INT,
+  CANDIDATE_DOUBLE,
+  CANDIDATE_MAP,
+  CANDIDATE_INVALID
+};
+
+struct candidate {
+  enum candidate_type type;
+  gchar *str;
+  gint64 i;
+  gdouble d;
+  gchar **strv;
+  GPtrArray *entries;
+};
+
+/* One entry of a map candidate, fields are indexed in schema order. An
+ * entry that is not an object is kept as invalid so that it is reported. */
+struct candidate_entry {
+  gchar *key;
+  gboolean invalid;
+  guint n_fields;
+  struct candidate **fields;
+};
+
 static void
-set_candidate(GHashTable *candidates, gchar *name, gchar *value)
+candidate_free(gpointer data)
+{
+  struct candidate *c = data;
+
+  if (c == NULL) {
+    return;
+  }
+
+  g_free(c->str);
+  g_strfreev(c->strv);
+  if (c->entries != NULL) {
+    g_ptr_array_unref(c->entries);
+  }
+  g_free(c);
+}
+
+static void
+candidate_entry_free(gpointer data)
+{
+  struct candidate_entry *e = data;
+
+  for (guint i = 0; i < e->n_fields; i++) {
+    candidate_free(e->fields[i]);
+  }
+  g_free(e->fields);
+  g_free(e->key);
+  g_free(e);
+}
+
+static struct candidate *
+candidate_new_string(gchar *value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_STRING;
+  c->str = value;
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_int(gint64 value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_INT;
+  c->i = value;
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_double(gdouble value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_DOUBLE;
+  c->d = value;
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_strv(gchar **value)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_STRING;
+  c->strv = value;
+
+  return c;
+}
+
+static struct candidate * G_GNUC_PRINTF(1, 2)
+candidate_new_invalid(const gchar *format, ...)
+{
+  struct candidate *c = NULL;
+  va_list args;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_INVALID;
+  va_start(args, format);
+  c->str = g_strdup_vprintf(format, args);
+  va_end(args);
+
+  return c;
+}
+
+static struct candidate *
+candidate_new_map(guint reserve)
+{
+  struct candidate *c = NULL;
+
+  c = g_new0(struct candidate, 1);
+  c->type = CANDIDATE_MAP;
+  c->entries = g_ptr_array_new_full(reserve, candidate_entry_free);
+
+  return c;
+}
+
+static struct candidate_entry *
+candidate_entry_new(gchar *key, guint n_fields)
+{
+  struct candidate_entry *e = NULL;
+
+  e = g_new0(struct candidate_entry, 1);
+  e->key = key;
+  e->n_fields = n_fields;
+  e->fields = g_new0(struct candidate *, n_fields);
+
+  return e;
+}
+
+static void
+put_candidate(GHashTable *candidates, gchar *name, struct candidate *c)
 {
   g_assert(candidates);
   g_assert(name);
 
+  if (c == NULL) {
+    return;
+  }
+
+  (void) g_hash_table_replace(candidates, (gpointer)name, (gpointer)c);
+}
+
+static void
+set_candidate(GHashTable *candidates, gchar *name, gchar *value)
+{
   if (value == NULL) {
     return;
   }
 
-  (void) g_hash_table_replace(candidates, (gpointer)name, (gpointer)value);
+  put_candidate(candidates, name, candidate_new_string(value));
 }
 
 
@@ -59,6 +221,8 @@ set_defaults(GHashTable *candidates)
   set_candidate(candidates, "main.deep.enumtest", g_strdup("hello"));
   set_candidate(candidates, "main.deep.params", g_strdup("Just a string"));
   set_candidate(candidates, "other", g_strdup("Just a string"));
+  set_candidate(candidates, "allow.paths", g_strdup("/static/*"));
+  set_candidate(candidates, "resolver.hosts", g_strdup("/etc/hosts"));
 
   return TRUE;
 }
@@ -104,102 +268,188 @@ parse_opts(GHashTable *candidates, gint *argc, gchar **argv[], GError **err)
   return TRUE;
 }
 static gchar *
-get_json_config_file()
+get_config_file()
 {
+  if (g_file_test("./config.msgpack", G_FILE_TEST_IS_REGULAR)) {
+    return g_strdup("./config.msgpack");
+  }
   return g_strdup("./config.json");
 }
 
-static void
-add_json_string_to_candidates(GHashTable *candidates, gchar *name, json_t *parent, gchar *json_name)
+static struct candidate *
+json_string_candidate(json_t *val)
 {
-  json_t *val = NULL;
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
+  }
 
-  val = json_object_get(parent, json_name);
-  if (val && json_is_string(val)) {
-    set_candidate(candidates, name, g_strdup(json_string_value(val)));
+  return candidate_new_invalid("expected a string");
+}
+
+static struct candidate *
+json_int_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
   }
+  if (json_is_integer(val)) {
+    return candidate_new_int(json_integer_value(val));
+  }
+
+  return candidate_new_invalid("expected an integer or a string");
 }
 
-static void
-add_json_size_to_candidates(GHashTable *candidates, gchar *name, json_t *parent, gchar *json_name)
+static struct candidate *
+json_size_candidate(json_t *val)
 {
-  json_t *val = NULL;
+  return json_int_candidate(val);
+}
 
-  val = json_object_get(parent, json_name);
-  if (val && json_is_string(val)) {
-    set_candidate(candidates, name, g_strdup(json_string_value(val)));
+static struct candidate *
+json_double_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
   }
+  if (json_is_number(val)) {
+    return candidate_new_double(json_number_value(val));
+  }
+
+  return candidate_new_invalid("expected a number or a string");
 }
 
-static void
-add_json_int_to_candidates(GHashTable *candidates, gchar *name, json_t *parent, gchar *json_name)
+static struct candidate *
+json_enum_candidate(json_t *val)
 {
-  json_t *val = NULL;
+  return json_string_candidate(val);
+}
 
-  val = json_object_get(parent, json_name);
-  if (val && json_is_string(val)) {
-    set_candidate(candidates, name, g_strdup(json_string_value(val)));
+static struct candidate *
+json_boolean_candidate(json_t *val)
+{
+  if (val == NULL) {
+    return NULL;
   }
-  if (val && json_is_integer(val)) {
-    set_candidate(candidates, name, g_strdup_printf("%lld", json_integer_value(val)));
+  if (json_is_boolean(val)) {
+    return candidate_new_string(g_strdup(json_is_true(val) ? "TRUE" : "FALSE"));
   }
+
+  return candidate_new_invalid("expected a boolean");
 }
 
-static void
-add_json_double_to_candidates(GHashTable *candidates, gchar *name, json_t *parent, gchar *json_name)
+/* A pattern is either a single string or an array of strings that are
+ * matched as one. */
+static struct candidate *
+json_regex_candidate(json_t *val)
 {
-  json_t *val = NULL;
+  GPtrArray *patterns = NULL;
+  json_t *pattern;
+  gsize i;
 
-  val = json_object_get(parent, json_name);
-  if (val && json_is_string(val)) {
-    set_candidate(candidates, name, g_strdup(json_string_value(val)));
+  if (val == NULL) {
+    return NULL;
+  }
+  if (json_is_string(val)) {
+    return candidate_new_string(g_strdup(json_string_value(val)));
   }
-  if (val && json_is_number(val)) {
-    set_candidate(candidates, name, g_strdup_printf("%lf", json_number_value(val)));
+  if (!json_is_array(val)) {
+    return candidate_new_invalid("expected a string or an array of strings");
+  }
+
+  patterns = g_ptr_array_sized_new(json_array_size(val) + 1);
+  json_array_foreach(val, i, pattern) {
+    if (!json_is_string(pattern)) {
+      g_ptr_array_set_free_func(patterns, g_free);
+      g_ptr_array_unref(patterns);
+      return candidate_new_invalid("element %u is not a string", (guint) i);
+    }
+    g_ptr_array_add(patterns, g_strdup(json_string_value(pattern)));
   }
+  g_ptr_array_add(patterns, NULL);
+
+  return candidate_new_strv((gchar **) g_ptr_array_free(patterns, FALSE));
 }
 
-static void
-add_json_enum_to_candidates(GHashTable *candidates, gchar *name, json_t *parent, gchar *json_name)
+static struct candidate *
+json_glob_candidate(json_t *val)
+{
+  return json_regex_candidate(val);
+}
+
+static struct candidate *
+json_file_candidate(json_t *val)
+{
+  return json_string_candidate(val);
+}
+
+static struct candidate *
+json_map_routes_candidate(json_t *val)
 {
-  json_t *val = NULL;
+  struct candidate *c = NULL;
+  struct candidate_entry *e = NULL;
+  const gchar *key;
+  json_t *obj;
+
+  if (val == NULL) {
+    return NULL;
+  }
+  if (!json_is_object(val)) {
+    return candidate_new_invalid("expected an object");
+  }
 
-  val = json_object_get(parent, json_name);
-  if (val && json_is_string(val)) {
-    set_candidate(candidates, name, g_strdup(json_string_value(val)));
+  c = candidate_new_map(json_object_size(val));
+  json_object_foreach(val, key, obj) {
+    e = candidate_entry_new(g_strdup(key), 3);
+    if (!json_is_object(obj)) {
+      e->invalid = TRUE;
+      g_ptr_array_add(c->entries, e);
+      continue;
+    }
+    e->fields[0] = json_string_candidate(json_object_get(obj, "backend"));
+    e->fields[1] = json_int_candidate(json_object_get(obj, "weight"));
+    e->fields[2] = json_enum_candidate(json_object_get(obj, "mode"));
+    g_ptr_array_add(c->entries, e);
   }
+
+  return c;
 }
 
+
 static void
-add_json_boolean_to_candidates(GHashTable *candidates, gchar *name, json_t *parent, gchar *json_name)
+json_init(void)
 {
-  json_t *val = NULL;
-  gchar *str = NULL;
+  static gsize initialized = 0;
 
-  val = json_object_get(parent, json_name);
-  if (val && json_is_boolean(val)) {
-    if (json_is_true(val)) {
-      str = g_strdup("TRUE");
-    } else {
-      str = g_strdup("FALSE");
-    }
-    set_candidate(candidates, name, str);
+  if (g_once_init_enter(&initialized)) {
+    json_set_alloc_funcs(g_malloc, g_free);
+    g_once_init_leave(&initialized, 1);
   }
 }
 
 static gboolean
-parse_json(GHashTable *candidates, GError **err)
+parse_json_file(GHashTable *candidates, const gchar *file, GError **err)
 {
-  gchar *file = NULL;
   json_error_t j_error;
-  json_set_alloc_funcs(g_malloc, g_free);
   json_t *root = NULL;
+  json_t *root_allow = NULL;
   json_t *root_main = NULL;
   json_t *root_main_deep = NULL;
+  json_t *root_resolver = NULL;
+
+  g_assert(candidates);
+  g_assert(file);
 
-  file = get_json_config_file();
+  json_init();
   root = json_load_file(file, 0, &j_error);
-  g_free(file);
 
   if (root == NULL) {
     g_set_error(err,
@@ -207,510 +457,1025 @@ parse_json(GHashTable *candidates, GError **err)
                 ERROR_CONFIG_NO_FILE,
                 "Could not parse config file %s, error: %s",
                 file,
-                g_strdup(j_error.text));
+                j_error.text);
     return FALSE;
   }
+  if (root != NULL) {
+    root_allow = json_object_get(root, "allow");
+  }
   if (root != NULL) {
     root_main = json_object_get(root, "main");
   }
   if (root_main != NULL) {
     root_main_deep = json_object_get(root_main, "deep");
   }
+  if (root != NULL) {
+    root_resolver = json_object_get(root, "resolver");
+  }
+  if (root != NULL) {
+    
+        put_candidate(candidates, "other", json_string_candidate(json_object_get(root, "other")));
+        put_candidate(candidates, "routes", json_map_routes_candidate(json_object_get(root, "routes")));
+  }
+  if (root_allow != NULL) {
+    
+        put_candidate(candidates, "allow.paths", json_glob_candidate(json_object_get(root_allow, "paths")));
+  }
   if (root_main != NULL) {
     
-        add_json_boolean_to_candidates(candidates, "main.third", root_main, "third");
-        add_json_double_to_candidates(candidates, "main.double_param", root_main, "double");
-        add_json_size_to_candidates(candidates, "main.size", root_main, "size");
-        add_json_string_to_candidates(candidates, "main.first", root_main, "first");
-        add_json_int_to_candidates(candidates, "main.second", root_main, "second");
+        put_candidate(candidates, "main.double_param", json_double_candidate(json_object_get(root_main, "double")));
+        put_candidate(candidates, "main.first", json_string_candidate(json_object_get(root_main, "first")));
+        put_candidate(candidates, "main.second", json_int_candidate(json_object_get(root_main, "second")));
+        put_candidate(candidates, "main.size", json_size_candidate(json_object_get(root_main, "size")));
+        put_candidate(candidates, "main.third", json_boolean_candidate(json_object_get(root_main, "third")));
   }
   if (root_main_deep != NULL) {
     
-        add_json_enum_to_candidates(candidates, "main.deep.enumtest", root_main_deep, "param_enum");
-        add_json_string_to_candidates(candidates, "main.deep.params", root_main_deep, "params");
-        add_json_string_to_candidates(candidates, "main.deep.param", root_main_deep, "param");
+        put_candidate(candidates, "main.deep.param", json_string_candidate(json_object_get(root_main_deep, "param")));
+        put_candidate(candidates, "main.deep.enumtest", json_enum_candidate(json_object_get(root_main_deep, "param_enum")));
+        put_candidate(candidates, "main.deep.params", json_string_candidate(json_object_get(root_main_deep, "params")));
+  }
+  if (root_resolver != NULL) {
+    
+        put_candidate(candidates, "resolver.hosts", json_file_candidate(json_object_get(root_resolver, "hosts")));
   }
 
   json_decref(root);
   return TRUE;
 }
 
-static gboolean
-set_string(const gchar *name, const gchar *str, gchar **dst, gint64 min, gint64 max, gint options, const gchar* opts[], GError **err)
-{
-  g_assert(name);
-  g_assert(str);
-  g_assert(dst);
-  g_assert(err != NULL && *err == NULL);
-
-  if (str == NULL) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_NOT_SET,
-                  "Parameter %s not set",
-                  name);
-    return FALSE;
-  }
 
-  if (strlen(str) < min) {
-    g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_TOO_SMALL,
-                  "Parameter %s too short (min %ld chars)",
-                  name, min);
-    return FALSE;
-  }
+/* Nesting deeper than this is rejected instead of recursing further. */
+#define MP_MAX_DEPTH 64
+
+struct mp_cursor {
+  const guchar *p;
+  const guchar *end;
+};
+
+enum mp_type {
+  MP_NIL,
+  MP_BOOL,
+  MP_INT,
+  MP_UINT,
+  MP_DOUBLE,
+  MP_STR,
+  MP_OTHER
+};
+
+struct mp_value {
+  enum mp_type type;
+  gboolean b;
+  gint64 i;
+  guint64 u;
+  gdouble d;
+  const gchar *str;
+  gsize len;
+};
 
-  if (strlen(str) > max) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_TOO_BIG,
-                  "Parameter %s too long (max %ld chars)",
-                  name, max);
+static gboolean
+mp_take(struct mp_cursor *cur, gsize n, const guchar **data)
+{
+  if ((gsize)(cur->end - cur->p) < n) {
     return FALSE;
   }
 
-  if (options > 0) {
-    gboolean ok = FALSE;
-    for (gint i = 0; i < options; i++) {
-        if (g_strcmp0(opts[i], str) == 0) {
-            ok = TRUE;
-            break;
-        }
-    }
-    if (!ok) {
-      g_set_error(err,
-              CONFIG_ERROR,
-              ERROR_CONFIG_INVALID,
-              "Parameter %s has an invalid value",
-              name);
-      return FALSE;
-    }
-  }
-
-  *dst = g_strdup(str);
+  *data = cur->p;
+  cur->p += n;
 
   return TRUE;
 }
 
 static gboolean
-set_int(const gchar *name, const gchar *str, gint64 *dst, gint64 min, gint64 max, gint options, const gint64 *opts, GError **err)
+mp_take_uint(struct mp_cursor *cur, gsize n, guint64 *val)
 {
-  gint64 tmp;
-  gchar *endp;
-
-  g_assert(name);
-  g_assert(str);
-  g_assert(dst);
-  g_assert(err != NULL && *err == NULL);
+  const guchar *data;
 
-  if (str == NULL) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_NOT_SET,
-                  "Parameter %s not set",
-                  name);
+  if (!mp_take(cur, n, &data)) {
     return FALSE;
   }
 
-  tmp = g_ascii_strtoll(str, &endp, 10);
-
-  if (tmp == 0 && endp == str) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_INVALID,
-                "Parameter %s has an invalid value",
-                name);
-    return FALSE;
+  *val = 0;
+  for (gsize i = 0; i < n; i++) {
+    *val = (*val << 8) | data[i];
   }
 
-  if (tmp == G_MAXINT64 && errno == ERANGE) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_BIG,
-                "Parameter %s too big (max %ld)",
-                name, max);
-    return FALSE;
-  }
+  return TRUE;
+}
 
-  if (tmp == G_MININT64 && errno == ERANGE) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_SMALL,
-                "Parameter %s too small (min %ld)",
-                name, min);
-    return FALSE;
-  }
+static gboolean mp_read(struct mp_cursor *cur, struct mp_value *val, gint depth);
 
-  if (tmp < min) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_SMALL,
-                "Parameter %s too small (min %ld)",
-                 name, min);
-    return FALSE;
-  }
+static gboolean
+mp_skip_items(struct mp_cursor *cur, guint64 count, gint depth)
+{
+  struct mp_value val;
 
-  if (tmp > max) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_TOO_BIG,
-                  "Parameter %s too big (max %ld)",
-                  name, max);
+  if (depth >= MP_MAX_DEPTH) {
     return FALSE;
   }
 
-  if (options > 0) {
-    gboolean ok = FALSE;
-    for (gint i = 0; i < options; i++) {
-        if (opts[i] == tmp) {
-            ok = TRUE;
-            break;
-        }
-    }
-    if (!ok) {
-      g_set_error(err,
-              CONFIG_ERROR,
-              ERROR_CONFIG_INVALID,
-              "Parameter %s has an invalid value",
-              name);
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &val, depth + 1)) {
       return FALSE;
     }
   }
 
-  *dst = tmp;
-
   return TRUE;
 }
 
+/* Reads one value. Strings point into the input buffer, containers, binary
+ * and extension values are skipped by their length prefix and reported as
+ * MP_OTHER. Returns FALSE on truncated or malformed input. */
 static gboolean
-set_size(const gchar *name, const gchar *str, gint64 *dst, gint64 min, gint64 max, gint options, const gint64 *opts, GError **err)
+mp_read(struct mp_cursor *cur, struct mp_value *val, gint depth)
 {
-  gint64 tmp;
-  gchar *endp;
-
-  g_assert(name);
-  g_assert(str);
-  g_assert(dst);
-  g_assert(err != NULL && *err == NULL);
+  const guchar *data;
+  guint64 len;
+  guchar t;
 
-  if (str == NULL) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_NOT_SET,
-                  "Parameter %s not set",
-                  name);
+  if (!mp_take(cur, 1, &data)) {
     return FALSE;
   }
+  t = *data;
+  val->type = MP_OTHER;
 
-  tmp = g_ascii_strtoll(str, &endp, 10);
-
-  if (tmp == 0 && endp == str) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_INVALID,
-                "Parameter %s has an invalid value",
-                name);
-    return FALSE;
-  }
-
-  if (tmp == G_MAXINT64 && errno == ERANGE) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_BIG,
-                "Parameter %s too big (max %ld)",
-                name, max);
-    return FALSE;
+  if (t <= 0x7f) {
+    val->type = MP_INT;
+    val->i = t;
+    return TRUE;
   }
-
-  if (tmp == G_MININT64 && errno == ERANGE) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_SMALL,
-                "Parameter %s too small (min %ld)",
-                name, min);
-    return FALSE;
+  if (t >= 0xe0) {
+    val->type = MP_INT;
+    val->i = (gint8) t;
+    return TRUE;
   }
-
-  if (g_str_has_suffix(str, "kb") || g_str_has_suffix(str, "KB") ) {
-    tmp = tmp * 1024;
+  if ((t & 0xe0) == 0xa0) {
+    len = t & 0x1f;
+    goto str;
   }
-
-  if (g_str_has_suffix(str, "mb") || g_str_has_suffix(str, "MB") ) {
-    tmp = tmp * 1024 * 1024;
+  if ((t & 0xf0) == 0x90) {
+    return mp_skip_items(cur, t & 0x0f, depth);
   }
-
-  if (g_str_has_suffix(str, "gb") || g_str_has_suffix(str, "GB") ) {
-    tmp = tmp * 1024 * 1024 * 1024;
+  if ((t & 0xf0) == 0x80) {
+    return mp_skip_items(cur, (t & 0x0f) * 2, depth);
   }
 
-  if (tmp < min) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_SMALL,
-                "Parameter %s too small (min %ld)",
-                 name, min);
-    return FALSE;
-  }
+  switch (t) {
+  case 0xc0:
+    val->type = MP_NIL;
+    return TRUE;
+  case 0xc2:
+  case 0xc3:
+    val->type = MP_BOOL;
+    val->b = t == 0xc3;
+    return TRUE;
+  case 0xcc:
+  case 0xcd:
+  case 0xce:
+  case 0xcf:
+    if (!mp_take_uint(cur, 1 << (t - 0xcc), &val->u)) {
+      return FALSE;
+    }
+    if (val->u > G_MAXINT64) {
+      val->type = MP_UINT;
+    } else {
+      val->type = MP_INT;
+      val->i = (gint64) val->u;
+    }
+    return TRUE;
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+    if (!mp_take_uint(cur, 1 << (t - 0xd0), &val->u)) {
+      return FALSE;
+    }
+    val->type = MP_INT;
+    switch (t) {
+    case 0xd0:
+      val->i = (gint8) val->u;
+      break;
+    case 0xd1:
+      val->i = (gint16) val->u;
+      break;
+    case 0xd2:
+      val->i = (gint32) val->u;
+      break;
+    default:
+      val->i = (gint64) val->u;
+    }
+    return TRUE;
+  case 0xca: {
+    guint32 bits;
+    gfloat f;
 
-  if (tmp > max) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_TOO_BIG,
-                  "Parameter %s too big (max %ld)",
-                  name, max);
-    return FALSE;
+    if (!mp_take_uint(cur, 4, &len)) {
+      return FALSE;
+    }
+    bits = (guint32) len;
+    memcpy(&f, &bits, sizeof(f));
+    val->type = MP_DOUBLE;
+    val->d = f;
+    return TRUE;
   }
-
-  if (options > 0) {
-    gboolean ok = FALSE;
-    for (gint i = 0; i < options; i++) {
-        if (opts[i] == tmp) {
-            ok = TRUE;
-            break;
-        }
-    }
-    if (!ok) {
-      g_set_error(err,
-              CONFIG_ERROR,
-              ERROR_CONFIG_INVALID,
-              "Parameter %s has an invalid value",
-              name);
+  case 0xcb:
+    if (!mp_take_uint(cur, 8, &val->u)) {
+      return FALSE;
+    }
+    memcpy(&val->d, &val->u, sizeof(val->d));
+    val->type = MP_DOUBLE;
+    return TRUE;
+  case 0xd9:
+  case 0xda:
+  case 0xdb:
+    if (!mp_take_uint(cur, 1 << (t - 0xd9), &len)) {
+      return FALSE;
+    }
+    goto str;
+  case 0xc4:
+  case 0xc5:
+  case 0xc6:
+    if (!mp_take_uint(cur, 1 << (t - 0xc4), &len)) {
+      return FALSE;
+    }
+    return mp_take(cur, len, &data);
+  case 0xd4:
+  case 0xd5:
+  case 0xd6:
+  case 0xd7:
+  case 0xd8:
+    return mp_take(cur, 1 + (1 << (t - 0xd4)), &data);
+  case 0xc7:
+  case 0xc8:
+  case 0xc9:
+    if (!mp_take_uint(cur, 1 << (t - 0xc7), &len)) {
+      return FALSE;
+    }
+    return mp_take(cur, len + 1, &data);
+  case 0xdc:
+  case 0xdd:
+    if (!mp_take_uint(cur, 2 << (t - 0xdc), &len)) {
       return FALSE;
     }
+    return mp_skip_items(cur, len, depth);
+  case 0xde:
+  case 0xdf:
+    if (!mp_take_uint(cur, 2 << (t - 0xde), &len)) {
+      return FALSE;
+    }
+    return mp_skip_items(cur, len * 2, depth);
+  default:
+    return FALSE;
   }
 
-  *dst = tmp;
+str:
+  if (!mp_take(cur, len, &data)) {
+    return FALSE;
+  }
+  val->type = MP_STR;
+  val->str = (const gchar *) data;
+  val->len = len;
 
   return TRUE;
 }
 
+/* Reads a map header. Any other value is skipped and treated as an empty
+ * map, the same way json_object_get() ignores non-objects. */
 static gboolean
-set_double(const gchar *name, const gchar *str, gdouble *dst, gdouble min, gdouble max, gint options, const gdouble *opts, GError **err)
+mp_read_map(struct mp_cursor *cur, guint64 *count, gint depth)
 {
-  gdouble tmp;
-  gchar *endp;
-
-  g_assert(name);
-  g_assert(str);
-  g_assert(dst);
-  g_assert(err != NULL && *err == NULL);
-
-  if (str == NULL) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_NOT_SET,
-                  "Parameter %s not set",
-                  name);
-    return FALSE;
-  }
-
-  tmp = g_ascii_strtod(str, &endp);
-
-  if (tmp == 0.0 && endp == str) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_INVALID,
-                "Parameter %s has an invalid value",
-                name);
-    return FALSE;
-  }
-
-  if (tmp == HUGE_VAL && errno == ERANGE) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_BIG,
-                "Parameter %s too big (max %lf)",
-                name, max);
-    return FALSE;
-  }
+  struct mp_value val;
+  guchar t;
 
-  if (tmp == 0 && errno == ERANGE) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_SMALL,
-                "Parameter %s too small (min %lf)",
-                name, min);
-    return FALSE;
-  }
+  *count = 0;
 
-  if (tmp < min) {
-    g_set_error(err,
-                CONFIG_ERROR,
-                ERROR_CONFIG_TOO_SMALL,
-                "Parameter %s too small (min %lf)",
-                 name, min);
+  if (cur->p >= cur->end) {
     return FALSE;
   }
+  t = *cur->p;
 
-  if (tmp > max) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_TOO_BIG,
-                  "Parameter %s too big (max %lf)",
-                  name, max);
-    return FALSE;
+  if ((t & 0xf0) == 0x80) {
+    cur->p++;
+    *count = t & 0x0f;
+    return TRUE;
   }
-
-  if (options > 0) {
-    gboolean ok = FALSE;
-    for (gint i = 0; i < options; i++) {
-        if (opts[i] == tmp) {
-            ok = TRUE;
-            break;
-        }
-    }
-    if (!ok) {
-      g_set_error(err,
-              CONFIG_ERROR,
-              ERROR_CONFIG_INVALID,
-              "Parameter %s has an invalid value",
-              name);
-      return FALSE;
-    }
+  if (t == 0xde || t == 0xdf) {
+    cur->p++;
+    return mp_take_uint(cur, 2 << (t - 0xde), count);
   }
 
-  *dst = tmp;
+  return mp_read(cur, &val, depth);
+}
 
-  return TRUE;
+static gboolean
+mp_peek_map(const struct mp_cursor *cur)
+{
+  return cur->p < cur->end && ((*cur->p & 0xf0) == 0x80 || *cur->p == 0xde || *cur->p == 0xdf);
 }
 
 static gboolean
-set_boolean(const gchar *name, const gchar *str, gboolean *dst, GError **err)
+mp_peek_array(const struct mp_cursor *cur)
 {
-  g_assert(name);
-  g_assert(str);
-  g_assert(dst);
-  g_assert(err != NULL && *err == NULL);
+  return cur->p < cur->end && ((*cur->p & 0xf0) == 0x90 || *cur->p == 0xdc || *cur->p == 0xdd);
+}
 
-  if (str == NULL) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_NOT_SET,
-                  "Parameter %s not set",
-                  name);
-    return FALSE;
-  }
+/* Reads the header of an array, only valid after mp_peek_array(). */
+static gboolean
+mp_read_array(struct mp_cursor *cur, guint64 *count)
+{
+  guchar t = *cur->p++;
 
-  if (g_strcmp0(str, "TRUE") == 0) {
-    *dst = TRUE;
-    return TRUE;
-  }
-  if (g_strcmp0(str, "FALSE") == 0) {
-    *dst = FALSE;
+  if ((t & 0xf0) == 0x90) {
+    *count = t & 0x0f;
     return TRUE;
   }
 
-  g_set_error(err,
-              CONFIG_ERROR,
-              ERROR_CONFIG_INVALID,
-              "Parameter %s has an invalid value",
-              name);
-
-  return FALSE;
+  return mp_take_uint(cur, 2 << (t - 0xdc), count);
 }
 
+static gboolean
+mp_key_is(const struct mp_value *key, const gchar *name, gsize len)
+{
+  return key->type == MP_STR && key->len == len && memcmp(key->str, name, len) == 0;
+}
+
+static gchar *
+mp_strdup(const struct mp_value *val)
+{
+  if (val->type == MP_STR) {
+    return g_strndup(val->str, val->len);
+  }
+  if (val->type == MP_UINT) {
+    return g_strdup_printf("%" G_GUINT64_FORMAT, val->u);
+  }
+
+  return NULL;
+}
 
 static gboolean
-set_enum_main_deep_enumtest(const gchar *name, const gchar *str, enum config_main_deep_enumtest *dst, GError **err)
+msgpack_string_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
 {
-  g_assert(name);
-  g_assert(str);
-  g_assert(dst);
-  g_assert(err != NULL && *err == NULL);
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_STR) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected a string");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_enum_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_string_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_int_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_INT) {
+    *c = candidate_new_int(val.i);
+  } else if (val.type == MP_STR || val.type == MP_UINT) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected an integer or a string");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_size_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_int_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_double_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
+    return FALSE;
+  }
+  if (val.type == MP_DOUBLE) {
+    *c = candidate_new_double(val.d);
+  } else if (val.type == MP_INT) {
+    *c = candidate_new_double((gdouble) val.i);
+  } else if (val.type == MP_UINT) {
+    *c = candidate_new_double((gdouble) val.u);
+  } else if (val.type == MP_STR) {
+    *c = candidate_new_string(mp_strdup(&val));
+  } else {
+    *c = candidate_new_invalid("expected a number or a string");
+  }
+
+  return TRUE;
+}
 
-  if (str == NULL) {
-      g_set_error(err,
-                  CONFIG_ERROR,
-                  ERROR_CONFIG_NOT_SET,
-                  "Parameter %s not set",
-                  name);
+static gboolean
+msgpack_boolean_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct mp_value val;
+
+  *c = NULL;
+  if (!mp_read(cur, &val, depth)) {
     return FALSE;
   }
-  if (g_strcmp0(str, "hello") == 0) {
-    *dst = MAIN_DEEP_ENUMTEST_HELLO;
+  if (val.type == MP_BOOL) {
+    *c = candidate_new_string(g_strdup(val.b ? "TRUE" : "FALSE"));
+  } else {
+    *c = candidate_new_invalid("expected a boolean");
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_regex_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  GPtrArray *patterns = NULL;
+  struct mp_value val;
+  guint64 invalid = G_MAXUINT64;
+  guint64 count;
+
+  *c = NULL;
+  if (!mp_peek_array(cur)) {
+    if (!mp_read(cur, &val, depth)) {
+      return FALSE;
+    }
+    if (val.type == MP_STR) {
+      *c = candidate_new_string(mp_strdup(&val));
+    } else {
+      *c = candidate_new_invalid("expected a string or an array of strings");
+    }
     return TRUE;
   }
-  if (g_strcmp0(str, "goodbye") == 0) {
-    *dst = MAIN_DEEP_ENUMTEST_GOODBYE;
+  if (depth >= MP_MAX_DEPTH || !mp_read_array(cur, &count)) {
+    return FALSE;
+  }
+
+  patterns = g_ptr_array_new_with_free_func(g_free);
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &val, depth + 1)) {
+      g_ptr_array_unref(patterns);
+      return FALSE;
+    }
+    if (val.type != MP_STR) {
+      invalid = MIN(invalid, i);
+      continue;
+    }
+    g_ptr_array_add(patterns, mp_strdup(&val));
+  }
+
+  if (invalid != G_MAXUINT64) {
+    g_ptr_array_unref(patterns);
+    *c = candidate_new_invalid("element %" G_GUINT64_FORMAT " is not a string", invalid);
     return TRUE;
   }
 
-  g_set_error(err,
-              CONFIG_ERROR,
-              ERROR_CONFIG_INVALID,
-              "Parameter %s has an invalid value",
-              name);
+  g_ptr_array_set_free_func(patterns, NULL);
+  g_ptr_array_add(patterns, NULL);
+  *c = candidate_new_strv((gchar **) g_ptr_array_free(patterns, FALSE));
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_glob_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_regex_candidate(cur, depth, c);
+}
 
+static gboolean
+msgpack_file_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  return msgpack_string_candidate(cur, depth, c);
+}
+
+static gboolean
+msgpack_map_routes_entry(struct mp_cursor *cur, gint depth, struct candidate_entry *e)
+{
+  struct candidate *field = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "backend", 7)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &field)) {
+        return FALSE;
+      }
+      candidate_free(e->fields[0]);
+      e->fields[0] = field;
+      continue;
+    }
+    if (mp_key_is(&key, "weight", 6)) {
+      if (!msgpack_int_candidate(cur, depth + 1, &field)) {
+        return FALSE;
+      }
+      candidate_free(e->fields[1]);
+      e->fields[1] = field;
+      continue;
+    }
+    if (mp_key_is(&key, "mode", 4)) {
+      if (!msgpack_enum_candidate(cur, depth + 1, &field)) {
+        return FALSE;
+      }
+      candidate_free(e->fields[2]);
+      e->fields[2] = field;
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_map_routes_candidate(struct mp_cursor *cur, gint depth, struct candidate **c)
+{
+  struct candidate_entry *e = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  *c = NULL;
+  if (!mp_peek_map(cur)) {
+    if (!mp_read(cur, &key, depth)) {
+      return FALSE;
+    }
+    *c = candidate_new_invalid("expected an object");
+    return TRUE;
+  }
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  /* Every entry takes at least two bytes, so do not trust larger counts. */
+  *c = candidate_new_map(MIN(count, (guint64)(cur->end - cur->p) / 2));
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      goto err;
+    }
+    if (key.type != MP_STR) {
+      if (!mp_read(cur, &key, depth + 1)) {
+        goto err;
+      }
+      continue;
+    }
+    e = candidate_entry_new(mp_strdup(&key), 3);
+    g_ptr_array_add((*c)->entries, e);
+    if (!mp_peek_map(cur)) {
+      e->invalid = TRUE;
+      if (!mp_read(cur, &key, depth + 1)) {
+        goto err;
+      }
+      continue;
+    }
+    if (!msgpack_map_routes_entry(cur, depth + 1, e)) {
+      goto err;
+    }
+  }
+
+  return TRUE;
+
+err:
+  g_clear_pointer(c, candidate_free);
   return FALSE;
 }
 
+static gboolean
+msgpack_object_root_allow(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "paths", 5)) {
+      if (!msgpack_glob_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "allow.paths", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
 
 static gboolean
-check_and_set(struct config *cfg, GHashTable *candidates, GError **err)
+msgpack_object_root_main_deep(GHashTable *candidates, struct mp_cursor *cur, gint depth)
 {
-    const gchar *valid_main_deep_param[] = { "hello", "goodbye"};
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
 
-  g_assert(cfg);
-  g_assert(candidates);
-  g_assert(err != NULL && *err == NULL);
-    if (!set_string("main.first", g_hash_table_lookup(candidates, "main.first"), &cfg->main.first, 1, 10, 0, NULL, err)) {
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "param", 5)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.deep.param", c);
+      continue;
     }
-    if (!set_int("main.second", g_hash_table_lookup(candidates, "main.second"), &cfg->main.second, 1, 10, 0, NULL, err)) {
+    if (mp_key_is(&key, "param_enum", 10)) {
+      if (!msgpack_enum_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.deep.enumtest", c);
+      continue;
     }
-    if (!set_boolean("main.third", g_hash_table_lookup(candidates, "main.third"), &cfg->main.third, err)) {
+    if (mp_key_is(&key, "params", 6)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.deep.params", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
     }
-    if (!set_double("main.double_param", g_hash_table_lookup(candidates, "main.double_param"), &cfg->main.double_param, -10, 100, 0, NULL, err)) {
+  }
+
+  return TRUE;
+}
+
+static gboolean
+msgpack_object_root_main(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
+
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
+
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "deep", 4)) {
+      if (!msgpack_object_root_main_deep(candidates, cur, depth + 1)) {
         return FALSE;
+      }
+      continue;
     }
-    if (!set_size("main.size", g_hash_table_lookup(candidates, "main.size"), &cfg->main.size, 0, 10000000, 0, NULL, err)) {
+    if (mp_key_is(&key, "double", 6)) {
+      if (!msgpack_double_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.double_param", c);
+      continue;
     }
-    if (!set_string("main.deep.param", g_hash_table_lookup(candidates, "main.deep.param"), &cfg->main.deep.param, 1, 24, 2, valid_main_deep_param, err)) {
+    if (mp_key_is(&key, "first", 5)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.first", c);
+      continue;
     }
-    if (!set_enum_main_deep_enumtest("main.deep.enumtest", g_hash_table_lookup(candidates, "main.deep.enumtest"), &cfg->main.deep.enumtest, err)) {
+    if (mp_key_is(&key, "second", 6)) {
+      if (!msgpack_int_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.second", c);
+      continue;
     }
-    if (!set_string("main.deep.params", g_hash_table_lookup(candidates, "main.deep.params"), &cfg->main.deep.params, 1, 24, 0, NULL, err)) {
+    if (mp_key_is(&key, "size", 4)) {
+      if (!msgpack_size_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.size", c);
+      continue;
     }
-    if (!set_string("other", g_hash_table_lookup(candidates, "other"), &cfg->other, 1, 24, 0, NULL, err)) {
+    if (mp_key_is(&key, "third", 5)) {
+      if (!msgpack_boolean_candidate(cur, depth + 1, &c)) {
         return FALSE;
+      }
+      put_candidate(candidates, "main.third", c);
+      continue;
     }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
 
   return TRUE;
 }
 
-gboolean
-config_parse(struct config *cfg, gint argc, gchar *argv[], gboolean die_on_json_error, GError **err) {
-  GHashTable * candidates = NULL;
+static gboolean
+msgpack_object_root_resolver(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
 
-  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
 
-  set_defaults(candidates);
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "hosts", 5)) {
+      if (!msgpack_file_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "resolver.hosts", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
 
+static gboolean
+msgpack_object_root(GHashTable *candidates, struct mp_cursor *cur, gint depth)
+{
+  struct candidate *c = NULL;
+  struct mp_value key;
+  guint64 count;
 
+  if (depth >= MP_MAX_DEPTH || !mp_read_map(cur, &count, depth)) {
+    return FALSE;
+  }
 
-  if (die_on_json_error) {
-    if (!parse_json(candidates, err)) {
-        goto err;
+  for (guint64 i = 0; i < count; i++) {
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+    if (mp_key_is(&key, "allow", 5)) {
+      if (!msgpack_object_root_allow(candidates, cur, depth + 1)) {
+        return FALSE;
+      }
+      continue;
     }
+    if (mp_key_is(&key, "main", 4)) {
+      if (!msgpack_object_root_main(candidates, cur, depth + 1)) {
+        return FALSE;
+      }
+      continue;
+    }
+    if (mp_key_is(&key, "other", 5)) {
+      if (!msgpack_string_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "other", c);
+      continue;
+    }
+    if (mp_key_is(&key, "resolver", 8)) {
+      if (!msgpack_object_root_resolver(candidates, cur, depth + 1)) {
+        return FALSE;
+      }
+      continue;
+    }
+    if (mp_key_is(&key, "routes", 6)) {
+      if (!msgpack_map_routes_candidate(cur, depth + 1, &c)) {
+        return FALSE;
+      }
+      put_candidate(candidates, "routes", c);
+      continue;
+    }
+    if (!mp_read(cur, &key, depth + 1)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean
+parse_msgpack_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  GMappedFile *map = NULL;
+  struct mp_cursor cur;
+  GError *local_err = NULL;
+  gboolean ok;
+
+  g_assert(candidates);
+  g_assert(file);
+
+  map = g_mapped_file_new(file, FALSE, &local_err);
+  if (map == NULL) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: %s",
+                file,
+                local_err->message);
+    g_clear_error(&local_err);
+    return FALSE;
+  }
+
+  cur.p = (const guchar *) g_mapped_file_get_contents(map);
+  cur.end = cur.p + g_mapped_file_get_length(map);
+
+  /* Like json_load_file, reject anything after the root value. */
+  ok = msgpack_object_root(candidates, &cur, 0) && cur.p == cur.end;
+  g_mapped_file_unref(map);
+
+  if (!ok) {
+    g_set_error(err,
+                CONFIG_ERROR,
+                ERROR_CONFIG_NO_FILE,
+                "Could not parse config file %s, error: malformed msgpack",
+                file);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/* Relative paths given in a config file are relative to that file. */
+static void
+resolve_path(GHashTable *candidates, const gchar *name, const gchar *file)
+{
+  struct candidate *c = NULL;
+  gchar *dir = NULL;
+  gchar *path = NULL;
+
+  c = g_hash_table_lookup(candidates, name);
+  if (c == NULL || c->str == NULL || g_path_is_absolute(c->str)) {
+    return;
+  }
+
+  dir = g_path_get_dirname(file);
+  path = g_build_filename(dir, c->str, NULL);
+  g_free(c->str);
+  c->str = path;
+  g_free(dir);
+}
+
+/* Only merges into candidates once the whole file has been decoded. */
+static gboolean
+parse_config_file(GHashTable *candidates, const gchar *file, GError **err)
+{
+  GHashTable *parsed = NULL;
+  GHashTableIter iter;
+  gpointer name;
+  gpointer c;
+  gboolean ok;
+
+  parsed = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  if (g_str_has_suffix(file, ".msgpack")) {
+    ok = parse_msgpack_file(parsed, file, err);
   } else {
-    (void)parse_json(candidates, NULL);
+    ok = parse_json_file(parsed, file, err);
   }
 
+  if (ok) {
+    resolve_path(parsed, "resolver.hosts", file);
+    g_hash_table_iter_init(&iter, parsed);
+    while (g_hash_table_iter_next(&iter, &name, &c)) {
+      g_hash_table_iter_steal(&iter);
+      (void) g_hash_table_replace(candidates, name, c);
+    }
+  }
+  g_hash_table_unref(parsed);
 
-  set_env(candidates);
+  return ok;
+}
 
+static gboolean
+parse_config(GHashTable *candidates, GError **err)
+{
+  gchar *file = NULL;
+  gboolean ok;
 
-  if (!parse_opts(candidates, &argc, &argv, err)) {
-    goto err;
+  file = get_config_file();
+  ok = parse_config_file(candidates, file, err);
+  g_free(file);
+
+  return ok;
+}
+
+/* Every source is read once above for all modules, each module then only
+ * validates its own parameters out of the shared candidates. */
+static gboolean
+check_and_set(struct config *cfg, GHashTable *candidates, GError **err)
+{
+  g_assert(cfg);
+  g_assert(candidates);
+  g_assert(err != NULL && *err == NULL);
+
+  if (!config_core_check_and_set(&cfg->core, candidates, err)) {
+    return FALSE;
+  }
+
+  if (!config_network_check_and_set(&cfg->network, candidates, err)) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+check_all(struct config *cfg, GHashTable *candidates, config_error_func func, gpointer user_data)
+{
+  gboolean ok = TRUE;
+
+  g_assert(cfg);
+  g_assert(candidates);
+  g_assert(func);
+
+  ok = config_core_check_all(&cfg->core, candidates, func, user_data) && ok;
+
+  ok = config_network_check_all(&cfg->network, candidates, func, user_data) && ok;
+
+  return ok;
+}
+
+/* Reads the sources that take precedence over the config file. Both come
+ * from process state, so this always runs on the calling thread. */
+static gboolean
+parse_overrides(GHashTable *overrides, gint *argc, gchar **argv[], GError **err)
+{
+  g_assert(overrides);
+
+  set_env(overrides);
+
+  if (!parse_opts(overrides, argc, argv, err)) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Reads the defaults and the config file, applies overrides on top and
+ * validates the result into cfg. Overrides are moved, not copied. */
+static gboolean
+parse_sources(struct config *cfg, GHashTable *overrides, gboolean die_on_json_error, GError **err)
+{
+  GHashTable * candidates = NULL;
+  GHashTableIter iter;
+  gpointer name;
+  gpointer c;
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+
+
+  if (die_on_json_error) {
+    if (!parse_config(candidates, err)) {
+        goto err;
+    }
+  } else {
+    (void)parse_config(candidates, NULL);
   }
 
+  g_hash_table_iter_init(&iter, overrides);
+  while (g_hash_table_iter_next(&iter, &name, &c)) {
+    g_hash_table_iter_steal(&iter);
+    (void) g_hash_table_replace(candidates, name, c);
+  }
 
   if (!check_and_set(cfg, candidates, err)) {
     goto err;
@@ -728,59 +1493,179 @@ err:
   return FALSE;
 }
 
+gboolean
+config_parse(struct config *cfg, gint argc, gchar *argv[], gboolean die_on_json_error, GError **err) {
+  GHashTable *overrides = NULL;
+  gboolean ok = FALSE;
 
-const gchar *
-config_name_enum_main_deep_enumtest(enum config_main_deep_enumtest val)
+  overrides = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  if (parse_overrides(overrides, &argc, &argv, err)) {
+    ok = parse_sources(cfg, overrides, die_on_json_error, err);
+  }
+  g_clear_pointer(&overrides, g_hash_table_unref);
+
+  return ok;
+}
+
+struct parse_task {
+  GHashTable *overrides;
+  gboolean die_on_json_error;
+  struct config cfg;
+};
+
+static void
+parse_task_free(gpointer data)
 {
-    switch (val) {
-    case MAIN_DEEP_ENUMTEST_HELLO:
-      return "hello";
-    case MAIN_DEEP_ENUMTEST_GOODBYE:
-      return "goodbye";
-    default:
-      g_assert_not_reached();
-    }
+  struct parse_task *t = data;
 
-    return "";
+  g_clear_pointer(&t->overrides, g_hash_table_unref);
+  config_clear(&t->cfg);
+  g_free(t);
 }
 
+static void
+parse_thread(GTask *task, gpointer source, gpointer data, GCancellable *cancellable)
+{
+  struct parse_task *t = data;
+  GError *err = NULL;
+
+  if (g_task_return_error_if_cancelled(task)) {
+    return;
+  }
+
+  if (!parse_sources(&t->cfg, t->overrides, t->die_on_json_error, &err)) {
+    g_task_return_error(task, err);
+    return;
+  }
+
+  g_task_return_boolean(task, TRUE);
+}
+
+void
+config_parse_async(gint argc, gchar *argv[], gboolean die_on_json_error, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+  struct parse_task *t = NULL;
+  GTask *task = NULL;
+  GError *err = NULL;
+
+  task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, config_parse_async);
+
+  t = g_new0(struct parse_task, 1);
+  t->overrides = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+  t->die_on_json_error = die_on_json_error;
+  g_task_set_task_data(task, t, parse_task_free);
+
+  if (!parse_overrides(t->overrides, &argc, &argv, &err)) {
+    g_task_return_error(task, err);
+  } else {
+    g_task_run_in_thread(task, parse_thread);
+  }
+
+  g_object_unref(task);
+}
+
+gboolean
+config_parse_finish(struct config *cfg, GAsyncResult *result, GError **err)
+{
+  struct parse_task *t = NULL;
+
+  g_assert(cfg);
+  g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+
+  if (!g_task_propagate_boolean(G_TASK(result), err)) {
+    return FALSE;
+  }
+
+  t = g_task_get_task_data(G_TASK(result));
+  *cfg = t->cfg;
+  memset(&t->cfg, 0, sizeof(t->cfg));
+
+  return TRUE;
+}
+
+gboolean
+config_check_file(const gchar *file, config_error_func func, gpointer user_data)
+{
+  struct config cfg = {};
+  GHashTable *candidates = NULL;
+  GError *err = NULL;
+  gboolean ok = FALSE;
+
+  g_assert(file);
+  g_assert(func);
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+  if (!parse_config_file(candidates, file, &err)) {
+    func("", err, user_data);
+    g_clear_error(&err);
+    goto out;
+  }
+
+  ok = check_all(&cfg, candidates, func, user_data);
+
+out:
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_clear(&cfg);
+
+  return ok;
+}
+
+gboolean
+config_parse_file(struct config *cfg, const gchar *file, GError **err)
+{
+  GHashTable *candidates = NULL;
+
+  g_assert(cfg);
+  g_assert(file);
+  g_assert(err != NULL && *err == NULL);
+
+  candidates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, candidate_free);
+
+  set_defaults(candidates);
+
+  if (!parse_config_file(candidates, file, err)) {
+    goto err;
+  }
+
+  if (!check_and_set(cfg, candidates, err)) {
+    goto err;
+  }
+  g_clear_pointer(&candidates, g_hash_table_unref);
+
+  return TRUE;
+
+err:
+  g_clear_pointer(&candidates, g_hash_table_unref);
+  config_clear(cfg);
+
+  return FALSE;
+}
 
 void
 config_clear(struct config *cfg)
 {
-  g_free(cfg->main.first);
-  g_free(cfg->main.deep.param);
-  g_free(cfg->main.deep.params);
-  g_free(cfg->other);
-  memset(cfg, 0, sizeof(*cfg));
+  config_core_clear(&cfg->core);
+  config_network_clear(&cfg->network);
 }
 
 gchar *
 config_to_string(struct config *cfg)
 {
-  return g_strdup_printf("main.first: %s\n"
-"main.second: %ld\n"
-"main.third: %d\n"
-"main.double_param: %lf\n"
-"main.size: %ld\n"
-"main.deep.param: %s\n"
-"main.deep.enumtest: %s\n"
-"main.deep.params: %s\n"
-"other: %s\n"
-,
-  cfg->main.first,
-  cfg->main.second,
-  cfg->main.third,
-  cfg->main.double_param,
-  cfg->main.size,
-  cfg->main.deep.param,
-  config_name_enum_main_deep_enumtest(cfg->main.deep.enumtest),
-  cfg->main.deep.params,
-  cfg->other);
-}
-
-GQuark
-config_error_quark(void)
-{
-  return g_quark_from_static_string ("xxconfig-error-quark");
-}
\ No newline at end of file
+  GString *out = g_string_new(NULL);
+  gchar *str = NULL;
+
+  str = config_core_to_string(&cfg->core);
+  g_string_append(out, str);
+  g_free(str);
+
+  str = config_network_to_string(&cfg->network);
+  g_string_append(out, str);
+  g_free(str);
+
+  return g_string_free(out, FALSE);
+}
@@ -1,61 +1,43 @@
-
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-#include <glib.h>
-
-#define CONFIG_ERROR config_error_quark()
-#define ERROR_CONFIG_NOT_SET 1
-#define ERROR_CONFIG_TOO_BIG 2
-#define ERROR_CONFIG_TOO_SMALL 3
-#define ERROR_CONFIG_INVALID 4
-#define ERROR_CONFIG_NO_FILE 5
-
-
-enum config_main_deep_enumtest {
-    MAIN_DEEP_ENUMTEST_HELLO,
-    MAIN_DEEP_ENUMTEST_GOODBYE,
-};
-
-
-
-struct deep {
-    gchar *param; /**  */
-    enum config_main_deep_enumtest enumtest; /**  */
-    gchar *params; /**  */
-};
-
-struct main {
-    gint64 second; /**  */
-    gboolean third; /**  */
-    gdouble double_param; /**  */
-    gint64 size; /**  */
-    struct deep deep; /**  */
-    gchar *first; /** This is a variable */
-};
+#include "config-common.h"
+#include "config-core.h"
+#include "config-network.h"
 
+/* Every module of the schema. A binary that only needs some of them can
+ * link just those and call their config_<module>_parse instead. */
 struct config {
-    gchar *other; /**  */
-    struct main main; /**  */
+    struct config_core core;
+    struct config_network network;
 };
 
-
+/* Reads the defaults, environment, command line and config file once and
+ * lets every module validate its part of them. */
 gboolean
 config_parse(struct config *cfg, gint argc, gchar *argv[], gboolean die_on_json_error, GError **err);
 
+/* Runs config_parse on a worker thread. The environment and command line
+ * are read before returning, file I/O and validation happen on the thread.
+ * callback is invoked in the thread-default main context of the caller. */
 void
-config_clear(struct config *cfg);
+config_parse_async(gint argc, gchar *argv[], gboolean die_on_json_error, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
 
-gchar *
-config_to_string(struct config *cfg);
+/* Moves the parsed config into cfg, which is left untouched on error. */
+gboolean
+config_parse_finish(struct config *cfg, GAsyncResult *result, GError **err);
 
+void
+config_clear(struct config *cfg);
 
-const gchar *
-config_name_enum_main_deep_enumtest(enum config_main_deep_enumtest val);
+gboolean
+config_check_file(const gchar *file, config_error_func func, gpointer user_data);
 
+/* Like config_parse but only reads the defaults and the given json or
+ * msgpack file, ignoring the environment and command line. */
+gboolean
+config_parse_file(struct config *cfg, const gchar *file, GError **err);
 
-GQuark
-config_error_quark(void);
+gchar *
+config_to_string(struct config *cfg);
 #endif /* _CONFIG_H_ */
-
-